@@ -2,7 +2,7 @@
  * Title:			AGON MOS
  * Author:			Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	11/11/2023
+ * Last Updated:	16/10/2026
  *
  * Modinfo:
  * 11/07/2022:		Version 0.01: Tweaks for Agon Light, Command Line code added
@@ -27,6 +27,7 @@
  * 03/08/2023:				RC2	+ Enhanced low-level keyboard functionality
  * 27/09/2023:					+ Updated RTC
  * 11/11/2023:				RC3	+ See Github for full list of changes
+ * 16/10/2026:					+ UART0 output is sent from the transmit interrupt
  */
 
 #include <eZ80.h>
@@ -81,7 +82,7 @@ int wait_ESP32(UART * pUART, UINT24 baudRate) {
 	pUART->stopBits = 1;
 	pUART->parity = PAR_NOPARITY;
 	pUART->flowControl = FCTL_HW;
-	pUART->interrupts = UART_IER_RECEIVEINT;
+	pUART->interrupts = UART_IER_RECEIVEINT | UART_IER_TRANSMITINT;
 
 	open_UART0(pUART);					// Open the UART 
 	init_timer0(10, 16, 0x00);  		// 10ms timer for delay
@@ -2,13 +2,14 @@
  * Title:			AGON MOS - Real Time Clock
  * Author:			Dean Belfield
  * Created:			09/03/2023
- * Last Updated:	26/09/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 15/03/2023:		Added rtc_getDateString, rtc_update
  * 21/03/2023:		Uses VDP values from defines.h
  * 05/06/2023:		Added RTC enable flag
  * 26/09/2023:		Timestamps now packed into 6 bytes
+ * 16/10/2026:		rtc_update waits on the RTC reply's sequence counter, with a timeout
  */
 
 #include <ez80.h>
@@ -20,6 +21,7 @@
 
 #include "defines.h"
 #include "uart.h"
+#include "timer.h"
 #include "clock.h"
 
 extern volatile BYTE vpd_protocol_flags;		// In globals.asm
@@ -53,9 +55,12 @@ const char * rtc_months[12][2] = {
 // Request an update of the RTC from the ESP32
 //
 void rtc_update() {
+	BYTE	seq;
+
 	if(!rtc_enable) {
 		return;
 	}
+	seq = vdp_protocol_seq[VDPP_SEQ_RTC];
 	vpd_protocol_flags &= 0xDF;	// Reset bit 5
 
 	putch(23);					// Request the time from the ESP32
@@ -63,7 +68,7 @@ void rtc_update() {
 	putch(VDP_rtc);
 	putch(0);					// 0: Get time
 
-	while((vpd_protocol_flags & 0x20) == 0);	
+	wait_VDPreply(VDPP_SEQ_RTC, seq);
 }
 
 // Unpack a 6-byte RTC packet into time struct
@@ -2,10 +2,18 @@
  * Title:			AGON MOS - MOS config
  * Author:			Dean Belfield
  * Created:			19/09/2022
- * Last Updated:	13/11/2022
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 13/11/2022:		Added MOS_starLoadAddress
+ * 16/10/2026:		Added MOS_diskCacheSectors, MOS_diskReadAhead, MOS_sdSpeedTest
+ *					Added MOS_fastSeekSize, MOS_fastSeekItems, MOS_fastSeekMaxItems
+ *					Added MOS_fileBuffers
+ *					Added MOS_execPath, MOS_execPathLength, MOS_execHashSize
+ *					Added MOS_starCacheSize, MOS_starCacheEntries
+ *					Added MOS_uart0RxTrigger
+ *					Added MOS_vdpTimeout
+ *					MOS_systemAddress is lowered to reserve the star command cache, which is now off by default
  */
 
 #ifndef CONFIG_H
@@ -17,6 +25,21 @@
 #define MOS_maxOpenFiles 8					// Maximum number of files that mos_FOPEN can open at the same time
 #define MOS_defaultLoadAddress	0x040000	// Default load address for LOAD and RUN commands
 #define MOS_starLoadAddress 0xB0000			// Address for loading on-SD star commands
-#define MOS_systemAddress   0xBC000
+#define MOS_systemAddress   (0xBC000 - MOS_starCacheSize)	// RAM from here up is reserved for MOS: the star command cache (if enabled), then the MOS data, heap and stack
 #define MOS_externLastRAMaddress 0xBFFFF
+#define MOS_diskCacheSectors 4				// Number of sectors in the disk I/O cache, allocated on the MOS heap (0 = no cache)
+#define MOS_diskReadAhead 4				// Number of sectors prefetched when a file is read sequentially, allocated on the MOS heap (0 = no read-ahead)
+#define MOS_sdSpeedTest 1					// 1 = check reads at the SPI clock chosen on mount, slowing down until they verify
+#define MOS_fastSeekSize 65536				// Files bigger than this opened read-only with mos_FOPEN get a cluster link map table for fast seeks
+#define MOS_fastSeekItems 10				// Initial size of a cluster link map table in DWORDs; it is grown to fit fragmented files
+#define MOS_fastSeekMaxItems 128			// Files too fragmented to fit a table this size stay in normal seek mode
+#define MOS_fileBuffers 1					// 1 = files opened with mos_FOPEN get their own sector buffer on the MOS heap on the first unaligned access
+#define MOS_execPath ".;/bin"				// Directories searched after /mos for commands run from the MOS prompt, separated by ';'
+#define MOS_execPathLength 64				// Size of the buffer for the search path set with SET PATH
+#define MOS_execHashSize 128				// Number of slots in the table of commands found in /mos and on the search path (0 = no table)
+#define MOS_starCacheSize 0					// Bytes reserved below the MOS data for copies of recently run star commands (0 = no cache)
+											// NB: Enabling this lowers MOS_systemAddress by the same amount, taking that RAM away from user programs and star commands
+#define MOS_starCacheEntries 4				// Maximum number of star commands held in the cache
+#define MOS_vdpTimeout 100					// Centiseconds to wait for a reply from the VDP before giving up
+#define MOS_uart0RxTrigger 8				// Bytes in the UART0 receive FIFO that raise an interrupt (1, 4, 8 or 14); fewer are picked up by the timeout
 #endif CONFIG_H
@@ -2,12 +2,13 @@
  * Title:			AGON MOS - MOS defines
  * Author:			Dean Belfield
  * Created:			21/03/2023
- * Last Updated:	10/11/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 22/03/2023:		The VDP commands are now indexed from 0x80
  * 24/03/2023:		Added DEBUG
  * 10/11/2023:		Added VDP_consolemode
+ * 16/10/2026:		Added VDPP_SEQ indexes, VDPS flags
  */
 
 #ifndef MOS_DEFINES_H
@@ -60,4 +61,20 @@ extern int _len_data;
 #define VDP_consolemode			0xFE
 #define VDP_terminalmode		0xFF
 
+// VDP reply sequence counters (indexes into vdp_protocol_seq, one per bit in vpd_protocol_flags)
+//
+#define VDPP_SEQ_CURSOR			0
+#define VDPP_SEQ_SCRCHAR		1
+#define VDPP_SEQ_POINT			2
+#define VDPP_SEQ_AUDIO			3
+#define VDPP_SEQ_MODE			4
+#define VDPP_SEQ_RTC			5
+#define VDPP_SEQ_MOUSE			6
+
+// Shadow VDP state (flags in vdp_shadow, set while MOS's copy is up to date)
+//
+#define VDPS_CURSOR				0x01	// cursorX, cursorY
+#define VDPS_MODE				0x02	// scrwidth, scrheight, scrcols, scrrows, scrcolours, scrmode
+#define VDPS_COLOURS			0x04	// The text foreground and background colours
+
 #endif MOS_DEFINES_H
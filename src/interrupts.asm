@@ -2,12 +2,14 @@
 ; Title:	AGON MOS - Interrupt handlers
 ; Author:	Dean Belfield
 ; Created:	03/08/2022
-; Last Updated:	29/03/2023
+; Last Updated:	16/10/2026
 ;
 ; Modinfo:
 ; 09/03/2023:	No longer uses timer interrupt 0 for SD card timing
 ; 29/03/2023:	Added support for UART1
 ; 10/11/2023:	Added support for I2C
+; 16/10/2026:	UART0 and VBLANK handlers refill the UART0 transmit FIFO from the transmit buffer
+;		UART0 handler empties the receive FIFO on each interrupt and counts interrupts and bytes
 
 			INCLUDE	"macros.inc"
 			INCLUDE	"equs.inc"
@@ -25,9 +27,12 @@
 
 			XREF	_clock
 			XREF	_vdp_protocol_data
+			XREF	_uart0_irqCount
+			XREF	_uart0_rxCount
 			
 			XREF	UART0_serial_RX
 			XREF	UART0_serial_TX
+			XREF	UART0_serial_TXFILL
 			XREF	mos_api
 			XREF	vdp_protocol			
 			
@@ -52,6 +57,7 @@ _vblank_handler:	DI
 			LD		A, (_clock + 3)
 			ADC		A, 0
 			LD		(_clock + 3), A			
+			CALL		UART0_serial_TXFILL	; Restart output held up by flow control
 			POP		HL
 			POP		DE
 			POP		BC
@@ -66,10 +72,19 @@ _uart0_handler:		DI
 			PUSH		BC
 			PUSH		DE
 			PUSH		HL
-			CALL		UART0_serial_RX
+			LD		HL, (_uart0_irqCount)	; Count the interrupt
+			INC		HL
+			LD		(_uart0_irqCount), HL
+$$:			CALL		UART0_serial_RX		; Read the next byte from the receive FIFO
+			JR		NC, $F			; Until it is empty
 			LD		C, A		
+			LD		HL, (_uart0_rxCount)	; Count the byte
+			INC		HL
+			LD		(_uart0_rxCount), HL
 			LD		HL, _vdp_protocol_data
 			CALL		vdp_protocol
+			JR		$B
+$$:			CALL		UART0_serial_TXFILL	; Refill the transmit FIFO
 			POP		HL
 			POP		DE
 			POP		BC
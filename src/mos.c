@@ -2,7 +2,7 @@
  * Title:			AGON MOS - MOS code
  * Author:			Dean Belfield
  * Created:			10/07/2022
- * Last Updated:	11/11/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 11/07/2022:		Added mos_cmdDIR, mos_cmdLOAD, removed mos_cmdBYE
@@ -35,6 +35,26 @@
  * 26/09/2023:		Refactored mos_GETRTC and mos_SETRTC
  * 10/11/2023:		Added CONSOLE to mos_cmdSET
  * 11/11/2023:		Added mos_cmdHELP, mos_cmdTYPE, mos_cmdCLS, mos_cmdMOUNT, mos_mount
+ * 16/10/2026:		mos_cmdMEM shows disk cache and read-ahead statistics
+ *					Added SDCRC to mos_cmdSET
+ *					Added mos_cmdDISKINFO, mos_cmdDISKBENCH
+ *					Large files opened read-only with mos_FOPEN get a cluster link map table for fast seeks
+ *					Files opened with mos_FOPEN get their own sector buffer on the first unaligned access
+ *					mos_SAVE and mos_COPY preallocate the file as one contiguous run
+ *					mos_cmdMEM shows FAT cache statistics
+ *					Added mos_cmdFREE, fat_getfree
+ *					mos_CD keeps cwd up to date, so mos_DIR no longer calls f_getcwd
+ *					mos_exec searches a configurable path and skips directories hashed without the command
+ *					The command hash table holds the short 8.3 alias of each executable as well as its long name
+ *					The command hash table is only rebuilt when a hashed directory changes
+ *					Added mos_cmdREHASH, PATH to mos_cmdSET
+ *					Star commands are kept in a RAM cache reserved below the MOS data; added mos_cmdCACHE
+ *					mos_TYPE streams the file straight from the sector buffer to UART0 with f_forward
+ *					mos_runBin flushes the UART0 transmit buffer before running the executable
+ *					Added RXTRIGGER to mos_cmdSET; mos_cmdMEM shows UART0 interrupt statistics
+ *					mos_DIR reads the text colours from the shadow VDP state; mos_runBin forgets it
+ *					Added ff_filext; the cluster link map table and sector buffer are kept outside the FIL
+ *					The cluster link map table and sector buffer come from ff_memalloc, and FatFs frees them
  */
 
 #include <eZ80.h>
@@ -51,6 +71,8 @@
 #include "uart.h"
 #include "clock.h"
 #include "ff.h"
+#include "diskio.h"
+#include "sd.h"
 #include "strings.h"
 #include "umm_malloc.h"
 #if DEBUG > 0
@@ -67,7 +89,9 @@ extern int 		exec24(UINT24 addr, char * params);	// In misc.asm
 extern BYTE scrcols, scrcolours, scrpixelIndex; // In globals.asm
 extern volatile	BYTE keyascii;					// In globals.asm
 extern volatile	BYTE vpd_protocol_flags;		// In globals.asm
+extern volatile	BYTE vdp_shadow;				// In globals.asm
 extern BYTE 	rtc;							// In globals.asm
+extern volatile	DWORD clock;					// In globals.asm
 
 static FATFS	fs;					// Handle for the file system
 static char * 	mos_strtok_ptr;		// Pointer for current position in string tokeniser
@@ -81,6 +105,42 @@ t_mosFileObject	mosFileObjects[MOS_maxOpenFiles];
 
 BOOL	vdpSupportsTextPalette = FALSE;
 
+// Command search path, and the table of commands found in /mos and the
+// directories on it, so that a command that is not there needs no directory scan
+//
+static char		execPath[MOS_execPathLength] = MOS_execPath;
+#if MOS_execHashSize > 0
+static t_mosExecHash	execHash[MOS_execHashSize];
+static BYTE		execHashValid;		// Bit n set: search directory n has been hashed (bit 0 is /mos)
+static WORD		execHashMod;		// FatFs count of changes to the hashed directories when the table was built
+#endif
+
+// Star command cache, which keeps copies of recently run star commands in the
+// reserved RAM just below the MOS data so that running them again needs no SD card access
+//
+#if MOS_starCacheSize > 0
+#define STARCACHE_ADDRESS	MOS_systemAddress
+#define STARCACHE_MAXSIZE	(MOS_starCacheSize < STARCACHE_ADDRESS - MOS_starLoadAddress ? MOS_starCacheSize : STARCACHE_ADDRESS - MOS_starLoadAddress)
+
+static t_mosStarCache	starCache[MOS_starCacheEntries];
+static DWORD	starCacheTick;		// Incremented on each use of the cache
+static DWORD	starCacheHits;
+static DWORD	starCacheMisses;
+#endif
+
+
+// Test names for DISKBENCH, in the order they run
+//
+#define DISKBENCH_FILE		"/diskbench.tmp"
+#define DISKBENCH_SIZE		256		// Default size of the test file in KB
+#define DISKBENCH_RANDOM	64		// Number of sectors in each random access test
+
+static char * diskbenchTests[] = {
+	"Sequential write",
+	"Sequential read",
+	"Random write",
+	"Random read",
+};
 
 // Array of MOS commands and pointer to the C function to run
 // NB this list is iterated over, so the order is important
@@ -89,6 +149,9 @@ BOOL	vdpSupportsTextPalette = FALSE;
 static t_mosCommand mosCommands[] = {
 	{ ".", 			&mos_cmdDIR,		HELP_CAT_ARGS,		HELP_CAT },
 	{ "CAT",		&mos_cmdDIR,		HELP_CAT_ARGS,		HELP_CAT },
+#if MOS_starCacheSize > 0
+	{ "CACHE",		&mos_cmdCACHE,		HELP_CACHE_ARGS,	HELP_CACHE },
+#endif
 	{ "CD", 		&mos_cmdCD,			HELP_CD_ARGS,		HELP_CD },
 	{ "CDIR", 		&mos_cmdCD,			HELP_CD_ARGS,		HELP_CD },
 	{ "CLS",		&mos_cmdCLS,		NULL,			HELP_CLS },
@@ -98,9 +161,12 @@ static t_mosCommand mosCommands[] = {
 	{ "DELETE",		&mos_cmdDEL,		HELP_DELETE_ARGS,	HELP_DELETE },
 	{ "DIR",		&mos_cmdDIR,		HELP_CAT_ARGS,		HELP_CAT },
 	{ "DISC",		&mos_cmdDISC,		NULL,		NULL },
+	{ "DISKBENCH",	&mos_cmdDISKBENCH,	HELP_DISKBENCH_ARGS,	HELP_DISKBENCH },
+	{ "DISKINFO",	&mos_cmdDISKINFO,	NULL,			HELP_DISKINFO },
 	{ "ECHO",		&mos_cmdECHO,		HELP_ECHO_ARGS,		HELP_ECHO },
 	{ "ERASE",		&mos_cmdDEL,		HELP_DELETE_ARGS,	HELP_DELETE },
 	{ "EXEC",		&mos_cmdEXEC,		HELP_EXEC_ARGS,		HELP_EXEC },
+	{ "FREE",		&mos_cmdFREE,		NULL,			HELP_FREE },
 	{ "HELP",		&mos_cmdHELP,		HELP_HELP_ARGS,		HELP_HELP },
 	{ "JMP",		&mos_cmdJMP,		HELP_JMP_ARGS,		HELP_JMP },
 	{ "LOAD",		&mos_cmdLOAD,		HELP_LOAD_ARGS,		HELP_LOAD },
@@ -113,6 +179,9 @@ static t_mosCommand mosCommands[] = {
 	{ "MV",			&mos_cmdREN,		HELP_RENAME_ARGS,	HELP_RENAME },
 	{ "PRINTF",		&mos_cmdPRINTF,		HELP_PRINTF_ARGS,	HELP_PRINTF },
 	{ "RENAME",		&mos_cmdREN,		HELP_RENAME_ARGS,	HELP_RENAME },
+#if MOS_execHashSize > 0
+	{ "REHASH",		&mos_cmdREHASH,		NULL,			HELP_REHASH },
+#endif
 	{ "RM",			&mos_cmdDEL,		HELP_DELETE_ARGS,	HELP_DELETE },
 	{ "RUN", 		&mos_cmdRUN,		HELP_RUN_ARGS,		HELP_RUN },
 	{ "SAVE", 		&mos_cmdSAVE,		HELP_SAVE_ARGS,		HELP_SAVE },
@@ -361,18 +430,334 @@ BOOL mos_parseString(char * ptr, char ** p_Value) {
 
 int mos_runBin(UINT24 addr) {
 	UINT8 mode = mos_execMode((UINT8 *)addr);
+	int result;
+
+	UART0_flush();	// Executables may drive UART0 directly, so send what is queued first
 	switch(mode) {
 		case 0:		// Z80 mode
-			return exec16(addr, mos_strtok_ptr);
+			result = exec16(addr, mos_strtok_ptr);
 			break;
 		case 1: 	// ADL mode
-			return exec24(addr, mos_strtok_ptr);
+			result = exec24(addr, mos_strtok_ptr);
 			break;	
 		default:	// Unrecognised header
 			return MOS_INVALID_EXECUTABLE;
+	}
+	vdp_shadow = 0;	// The executable may have talked to the VDP behind our back
+	return result;
+}
+
+// Get the next directory from the command search path
+// Parameters:
+// - p: Pointer to the current position in the search path, moved on past the directory
+// - dir: Buffer for the directory, MOS_execPathLength bytes long
+// Returns:
+// - FALSE at the end of the search path
+//
+static BOOL mos_execPathNext(char ** p, char * dir) {
+	char *	s = *p;
+	int		len;
+
+	if(*s == 0) {
+		return FALSE;
+	}
+	for(len = 0; s[len] && s[len] != ';'; len++);
+	memcpy(dir, s, len);
+	dir[len] = 0;
+	*p = s[len] ? s + len + 1 : s + len;
+	return TRUE;
+}
+
+#if MOS_execHashSize > 0
+// Hash a command name, ignoring case
+// Parameters:
+// - name: Pointer to the name
+// - len: Number of characters to hash
+// Returns:
+// - Hash value, never 0
+//
+static WORD mos_execHashName(char * name, int len) {
+	WORD	hash = 0;
+
+	while(len-- > 0) {
+		hash = hash * 31 + toupper(*name++);
+	}
+	return hash ? hash : 1;
+}
+
+// Find the slot for a hash in the command hash table
+// Parameters:
+// - hash: Hash of the command name
+// - add: TRUE to claim an empty slot if the hash is not in the table
+// Returns:
+// - Slot number, or -1 if not found (or the table is full)
+//
+static int mos_execHashSlot(WORD hash, BOOL add) {
+	int	i;
+	int	slot = hash % MOS_execHashSize;
+
+	for(i = 0; i < MOS_execHashSize; i++) {
+		if(execHash[slot].hash == hash) {
+			return slot;
+		}
+		if(execHash[slot].hash == 0) {
+			if(!add) {
+				return -1;
+			}
+			execHash[slot].hash = hash;
+			execHash[slot].dirs = 0;
+			return slot;
+		}
+		slot = (slot + 1) % MOS_execHashSize;
+	}
+	return -1;
+}
+
+// Add a file name to the command hash table if it is an executable
+// Parameters:
+// - fname: The file name
+// - bit: Bit that marks the directory in the table
+// Returns:
+// - 1 if added, 0 if the file is not an executable, -1 if the table is full
+//
+static int mos_execHashFile(char * fname, BYTE bit) {
+	int	len = strlen(fname) - 4;
+	int	slot;
+
+	if(len <= 0 || strcasecmp(fname + len, ".bin") != 0) {
+		return 0;
+	}
+	slot = mos_execHashSlot(mos_execHashName(fname, len), TRUE);
+	if(slot < 0) {
+		return -1;
+	}
+	execHash[slot].dirs |= bit;
+	return 1;
+}
+
+// Add the executables in a directory to the command hash table
+// Both the long name and the short 8.3 alias are added, as FatFs opens a file by either
+// Parameters:
+// - dir: Path of the directory
+// - bit: Bit that marks the directory in the table
+// Returns:
+// - Number of commands added
+//
+static int mos_execHashDir(char * dir, BYTE bit) {
+	DIR		d;
+	FILINFO	fno;
+	FRESULT	fr;
+	int		added;
+	int		count = 0;
+
+	fr = f_opendir(&d, dir);
+	if(fr == FR_NO_PATH || fr == FR_NO_FILE) {	// A missing directory has no commands in it
+		execHashValid |= bit;
+		return 0;
+	}
+	if(fr != FR_OK) {
+		return 0;
+	}
+	if(fs.dwcount >= FF_DIR_WATCH) {			// FatFs can watch no more directories, so leave this one unhashed
+		f_closedir(&d);
+		return 0;
+	}
+	fs.dwclust[fs.dwcount++] = d.obj.sclust;	// Have FatFs count entries added to or removed from this directory
+	while((fr = f_readdir(&d, &fno)) == FR_OK && fno.fname[0]) {
+		if(fno.fattrib & AM_DIR) {
+			continue;
+		}
+		added = mos_execHashFile(fno.fname, bit);
+#if FF_USE_LFN
+		if(added >= 0 && fno.altname[0] && strcasecmp(fno.altname, fno.fname) != 0) {
+			if(mos_execHashFile(fno.altname, bit) < 0) {
+				added = -1;
+			}
+		}
+#endif
+		if(added < 0) {							// The table is full, so leave this directory unhashed
+			fr = FR_INT_ERR;
 			break;
+		}
+		count += added;
+	}
+	f_closedir(&d);
+	if(fr == FR_OK) {
+		execHashValid |= bit;
+	}
+	return count;
+}
+
+// Rebuild the command hash table from /mos and the absolute directories on the search path
+// Returns:
+// - Number of commands found
+//
+int mos_execRehash(void) {
+	char	dir[MOS_execPathLength];
+	char *	p = execPath;
+	BYTE	bit = 2;
+	int		count;
+
+	memset(execHash, 0, sizeof(execHash));
+	execHashValid = 0;
+	fs.dwcount = 0;
+	execHashMod = fs.dirmod;
+	count = mos_execHashDir("/mos", 1);
+	while(bit != 0 && mos_execPathNext(&p, dir)) {
+		if(dir[0] == '/') {						// Relative directories depend on cwd, so are always searched
+			count += mos_execHashDir(dir, bit);
+		}
+		bit <<= 1;
+	}
+	return count;
+}
+
+// Check whether a command could be in a search directory
+// Parameters:
+// - name: The command name
+// - bit: Bit that marks the directory in the table (0 if it is not hashed)
+// Returns:
+// - FALSE if the directory has been hashed and the command is not in it
+//
+static BOOL mos_execHashed(char * name, BYTE bit) {
+	int	slot;
+
+	if(execHashMod != fs.dirmod) {				// A hashed directory has changed since the table was built
+		mos_execRehash();
+	}
+	if(!(execHashValid & bit) || strchr(name, '/') != NULL) {
+		return TRUE;
 	}
+	slot = mos_execHashSlot(mos_execHashName(name, strlen(name)), FALSE);
+	return slot >= 0 && (execHash[slot].dirs & bit);
 }
+#else
+#define mos_execHashed(name, bit) TRUE
+#endif
+
+#if MOS_starCacheSize > 0
+// Checksum a star command image
+// Parameters:
+// - p: Pointer to the image
+// - size: Size of the image
+// Returns:
+// - Checksum
+//
+static WORD mos_starCacheSum(BYTE * p, UINT24 size) {
+	WORD	sum = 0;
+
+	while(size-- > 0) {
+		sum = ((sum << 1) | (sum >> 15)) + *p++;
+	}
+	return sum;
+}
+
+// Find room in the star command cache, replacing the least recently used entries until it fits
+// Parameters:
+// - size: Size of the image to store
+// Returns:
+// - Pointer to a free entry, with its offset set
+//
+static t_mosStarCache * mos_starCacheAlloc(UINT24 size) {
+	t_mosStarCache *	entry;
+	t_mosStarCache *	slot = NULL;
+	UINT24	offset;
+	int		i, j;
+
+	for(;;) {
+		for(i = 0; i < MOS_starCacheEntries && slot == NULL; i++) {
+			if(starCache[i].path[0] == 0) {
+				slot = &starCache[i];
+			}
+		}
+		for(i = -1; slot != NULL && i < MOS_starCacheEntries; i++) {	// Try the start of the cache, then the end of each image in it
+			if(i >= 0 && starCache[i].path[0] == 0) {
+				continue;
+			}
+			offset = i < 0 ? 0 : starCache[i].offset + starCache[i].size;
+			if(offset + size > MOS_starCacheSize) {
+				continue;
+			}
+			for(j = 0; j < MOS_starCacheEntries; j++) {
+				entry = &starCache[j];
+				if(entry->path[0] && offset < entry->offset + entry->size && entry->offset < offset + size) {
+					break;
+				}
+			}
+			if(j == MOS_starCacheEntries) {
+				slot->offset = offset;
+				return slot;
+			}
+		}
+		entry = NULL;									// No room, so drop the least recently used image
+		for(i = 0; i < MOS_starCacheEntries; i++) {
+			if(starCache[i].path[0] && (entry == NULL || starCache[i].used < entry->used)) {
+				entry = &starCache[i];
+			}
+		}
+		entry->path[0] = 0;
+	}
+}
+
+// Load a star command to the star command address, from the cache if it holds a current copy
+// Parameters:
+// - path: Path of the star command
+// Returns:
+// - FatFS return code (or MOS error code)
+//
+static UINT24 mos_starLoad(char * path) {
+	FILINFO	fil;
+	FRESULT	fr;
+	t_mosStarCache *	entry;
+	int		i;
+
+	fr = f_stat(path, &fil);
+	if(fr != FR_OK) {
+		return fr;
+	}
+	for(i = 0; i < MOS_starCacheEntries; i++) {
+		entry = &starCache[i];
+		if(entry->path[0] && strcasecmp(entry->path, path) == 0) {
+			if(
+				entry->size == fil.fsize && entry->fdate == fil.fdate && entry->ftime == fil.ftime &&
+				entry->sum == mos_starCacheSum((BYTE *)(STARCACHE_ADDRESS + entry->offset), entry->size)
+			) {
+				memcpy((void *)MOS_starLoadAddress, (void *)(STARCACHE_ADDRESS + entry->offset), entry->size);
+				entry->used = ++starCacheTick;
+				starCacheHits++;
+				return FR_OK;
+			}
+			entry->path[0] = 0;							// The file has changed, or the copy has been overwritten
+			break;
+		}
+	}
+	starCacheMisses++;
+	fr = mos_LOAD(path, MOS_starLoadAddress, 0);
+	if(fr == FR_OK && fil.fsize <= STARCACHE_MAXSIZE && strlen(path) < sizeof(entry->path)) {
+		entry = mos_starCacheAlloc(fil.fsize);
+		memcpy((void *)(STARCACHE_ADDRESS + entry->offset), (void *)MOS_starLoadAddress, fil.fsize);
+		strcpy(entry->path, path);
+		entry->size = fil.fsize;
+		entry->fdate = fil.fdate;
+		entry->ftime = fil.ftime;
+		entry->sum = mos_starCacheSum((BYTE *)MOS_starLoadAddress, fil.fsize);
+		entry->used = ++starCacheTick;
+	}
+	return fr;
+}
+
+// Empty the star command cache
+//
+static void mos_starCacheFlush(void) {
+	int	i;
+
+	for(i = 0; i < MOS_starCacheEntries; i++) {
+		starCache[i].path[0] = 0;
+	}
+}
+#else
+#define mos_starLoad(path) mos_LOAD(path, MOS_starLoadAddress, 0)
+#endif
 
 // Execute a MOS command
 // Parameters:
@@ -385,6 +770,9 @@ int mos_exec(char * buffer, BOOL in_mos) {
 	int 	fr = 0;
 	int 	(*func)(char * ptr);
 	char	path[256];
+	char	dir[MOS_execPathLength];
+	char *	search;
+	BYTE	bit;
 	UINT8	mode;
 	t_mosCommand *cmd;
 
@@ -405,31 +793,37 @@ int mos_exec(char * buffer, BOOL in_mos) {
 				return MOS_INVALID_COMMAND;
 			}
 			else {
-				sprintf(path, "/mos/%s.bin", ptr);
-				fr = mos_LOAD(path, MOS_starLoadAddress, 0);
-				if (fr == FR_OK) {
-					return mos_runBin(MOS_starLoadAddress);
-				}
-				if (fr == MOS_OVERLAPPING_SYSTEM) {
-					return fr;
-				}
-				
-				if (in_mos) {
-					sprintf(path, "%s.bin", ptr);
-					fr = mos_LOAD(path, MOS_defaultLoadAddress, 0);
+				fr = FR_NO_FILE;
+				if (mos_execHashed(ptr, 1)) {
+					sprintf(path, "/mos/%s.bin", ptr);
+					fr = mos_starLoad(path);
 					if (fr == FR_OK) {
-						return mos_runBin(MOS_defaultLoadAddress);
+						return mos_runBin(MOS_starLoadAddress);
 					}
 					if (fr == MOS_OVERLAPPING_SYSTEM) {
 						return fr;
 					}
-					sprintf(path, "/bin/%s.bin", ptr);
-					fr = mos_LOAD(path, MOS_defaultLoadAddress, 0);
-					if (fr == FR_OK) {
-						return mos_runBin(MOS_defaultLoadAddress);
-					}
-					if (fr == MOS_OVERLAPPING_SYSTEM) {
-						return fr;
+				}
+				
+				if (in_mos) {
+					search = execPath;
+					for (bit = 2; mos_execPathNext(&search, dir); bit <<= 1) {
+						if (!mos_execHashed(ptr, dir[0] == '/' ? bit : 0) || strlen(dir) + strlen(ptr) > 250) {
+							continue;
+						}
+						if (dir[0] == 0 || strcmp(dir, ".") == 0) {
+							sprintf(path, "%s.bin", ptr);
+						}
+						else {
+							sprintf(path, "%s/%s.bin", dir, ptr);
+						}
+						fr = mos_LOAD(path, MOS_defaultLoadAddress, 0);
+						if (fr == FR_OK) {
+							return mos_runBin(MOS_defaultLoadAddress);
+						}
+						if (fr == MOS_OVERLAPPING_SYSTEM) {
+							return fr;
+						}
 					}
 				}				
 				if (fr == FR_NO_FILE || fr == FR_NO_PATH) {
@@ -464,6 +858,304 @@ int mos_cmdDISC(char *ptr) {
 	return 0;
 }
 
+// Name a card manufacturer from the CID manufacturer ID
+// The IDs are assigned by the SD Association, but are not published
+//
+static char * mos_sdManufacturer(BYTE mid) {
+	switch(mid) {
+		case 0x01:	return "Panasonic";
+		case 0x02:	return "Toshiba";
+		case 0x03:	return "SanDisk";
+		case 0x1B:	return "Samsung";
+		case 0x1D:	return "ADATA";
+		case 0x27:	return "Phison";
+		case 0x28:	return "Lexar";
+		case 0x31:	return "Silicon Power";
+		case 0x41:	return "Kingston";
+		case 0x74:	return "Transcend";
+		case 0x76:	return "Patriot";
+		case 0x82:	return "Sony";
+	}
+	return "Unknown";
+}
+
+// DISKINFO
+// Parameters:
+// - ptr: Pointer to the argument string in the line edit buffer
+// Returns:
+// - MOS error code
+//
+int mos_cmdDISKINFO(char * ptr) {
+	BYTE	cid[16];
+	BYTE	csd[16];
+	BYTE	ocr[4];
+	BYTE	sds[64];
+	LBA_t	sectors;
+	char *	type;
+
+	if(
+		disk_ioctl(0, MMC_GET_CID, cid) != RES_OK ||
+		disk_ioctl(0, MMC_GET_CSD, csd) != RES_OK ||
+		disk_ioctl(0, MMC_GET_OCR, ocr) != RES_OK ||
+		disk_ioctl(0, GET_SECTOR_COUNT, &sectors) != RES_OK
+	) {
+		return FR_DISK_ERR;
+	}
+
+	// Block addressed cards set CCS in the OCR; anything over 32GB is SDXC
+	//
+	if(ocr[0] & 0x40) {
+		type = sectors > 0x4000000 ? "SDXC" : "SDHC";
+	}
+	else {
+		type = "SDSC";
+	}
+
+	printf("Card type:    %s (CSD version %d.0)\r\n", type, (csd[0] >> 6) + 1);
+	printf("Manufacturer: %s (&%02X), OEM \"%c%c\"\r\n", mos_sdManufacturer(cid[0]), cid[0], cid[1], cid[2]);
+	printf("Product:      %c%c%c%c%c revision %d.%d\r\n", cid[3], cid[4], cid[5], cid[6], cid[7], cid[8] >> 4, cid[8] & 0x0F);
+	printf("Serial:       &%02X%02X%02X%02X\r\n", cid[9], cid[10], cid[11], cid[12]);
+	printf("Manufactured: %02d/%d\r\n", cid[14] & 0x0F, 2000 + (((cid[13] & 0x0F) << 4) | (cid[14] >> 4)));
+	printf("Capacity:     %lu MB (%lu sectors)\r\n", sectors >> 11, sectors);
+
+	// The speed class is only in the SD status, which older cards may not support
+	//
+	if(disk_ioctl(0, MMC_GET_SDSTAT, sds) == RES_OK) {
+		printf("Speed class:  ");
+		switch(sds[8]) {
+			case 0:		printf("Class 0"); break;
+			case 1:		printf("Class 2"); break;
+			case 2:		printf("Class 4"); break;
+			case 3:		printf("Class 6"); break;
+			case 4:		printf("Class 10"); break;
+			default:	printf("Unknown"); break;
+		}
+		if(sds[14] >> 4) {
+			printf(", UHS-%d", sds[14] >> 4);
+		}
+		printf("\r\n");
+	}
+	printf("OCR:          &%02X%02X%02X%02X\r\n", ocr[0], ocr[1], ocr[2], ocr[3]);
+	return 0;
+}
+
+// Work out a throughput in KB/s
+// Parameters:
+// - bytes: Number of bytes transferred
+// - cs: Time taken in centiseconds
+//
+static DWORD mos_benchRate(DWORD bytes, DWORD cs) {
+	return (bytes * 25) / ((cs ? cs : 1) * 256);
+}
+
+// DISKBENCH [<kb> [<csvfile>]]
+// Parameters:
+// - ptr: Pointer to the argument string in the line edit buffer
+// Returns:
+// - MOS error code
+//
+int mos_cmdDISKBENCH(char * ptr) {
+	FRESULT	fr;
+	FIL		fil;
+	char *	p;
+	char *	e;
+	char *	csvname = NULL;
+	long	kb = DISKBENCH_SIZE;
+	BYTE *	buffer = NULL;
+	UINT	chunk;
+	UINT	n;
+	UINT	i;
+	int		test;
+	DWORD	size;
+	DWORD	sectors;
+	DWORD	start;
+	DWORD	bytes[4];
+	DWORD	ops[4];
+	DWORD	elapsed[4];
+
+	if(mos_parseString(NULL, &p)) {
+		kb = strtol(p, &e, 10);
+		if(*e != 0 || kb < 1 || kb > 16384) {
+			return FR_INVALID_PARAMETER;
+		}
+		mos_parseString(NULL, &csvname);
+	}
+	size = (DWORD)kb * 1024;
+	sectors = size / 512;
+
+	// Use the biggest buffer the heap can spare, to keep the FatFs overhead down
+	//
+	for(chunk = 4096; chunk >= 512; chunk >>= 1) {
+		buffer = umm_malloc(chunk);
+		if(buffer) break;
+	}
+	if(buffer == NULL) {
+		return MOS_OUT_OF_MEMORY;
+	}
+	for(i = 0; i < chunk; i++) {
+		buffer[i] = i;
+	}
+
+	printf("Benchmarking %ld KB with a %u byte buffer\r\n", kb, chunk);
+
+	fr = f_open(&fil, DISKBENCH_FILE, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+	if(fr != FR_OK) {
+		umm_free(buffer);
+		return fr;
+	}
+
+	// Sequential write, including the time for the card to finish programming
+	//
+	bytes[0] = 0;
+	ops[0] = 0;
+	start = clock;
+	while(fr == FR_OK && bytes[0] < size) {
+		fr = f_write(&fil, buffer, chunk, &n);
+		if(n < chunk && fr == FR_OK) fr = FR_DENIED;	// Disk full
+		bytes[0] += n;
+		ops[0]++;
+	}
+	if(fr == FR_OK) fr = f_sync(&fil);
+	elapsed[0] = clock - start;
+
+	// Sequential read
+	//
+	bytes[1] = 0;
+	ops[1] = 0;
+	if(fr == FR_OK) fr = f_lseek(&fil, 0);
+	start = clock;
+	while(fr == FR_OK && bytes[1] < size) {
+		fr = f_read(&fil, buffer, chunk, &n);
+		if(n == 0) break;
+		bytes[1] += n;
+		ops[1]++;
+	}
+	elapsed[1] = clock - start;
+
+	// Random single sector writes
+	//
+	bytes[2] = 0;
+	ops[2] = 0;
+	start = clock;
+	while(fr == FR_OK && ops[2] < DISKBENCH_RANDOM) {
+		fr = f_lseek(&fil, ((DWORD)rand() % sectors) * 512);
+		if(fr == FR_OK) fr = f_write(&fil, buffer, 512, &n);
+		bytes[2] += n;
+		ops[2]++;
+	}
+	if(fr == FR_OK) fr = f_sync(&fil);
+	elapsed[2] = clock - start;
+
+	// Random single sector reads
+	//
+	bytes[3] = 0;
+	ops[3] = 0;
+	start = clock;
+	while(fr == FR_OK && ops[3] < DISKBENCH_RANDOM) {
+		fr = f_lseek(&fil, ((DWORD)rand() % sectors) * 512);
+		if(fr == FR_OK) fr = f_read(&fil, buffer, 512, &n);
+		bytes[3] += n;
+		ops[3]++;
+	}
+	elapsed[3] = clock - start;
+
+	f_close(&fil);
+	f_unlink(DISKBENCH_FILE);
+	umm_free(buffer);
+	if(fr != FR_OK) {
+		return fr;
+	}
+
+	for(test = 0; test < 4; test++) {
+		printf("%-16s %6lu KB/s %8lu us/op\r\n", diskbenchTests[test], mos_benchRate(bytes[test], elapsed[test]), elapsed[test] * 10000 / ops[test]);
+	}
+
+	// Append the results to a CSV file, with a header if the file is new
+	//
+	if(csvname) {
+		fr = f_open(&fil, csvname, FA_WRITE | FA_OPEN_APPEND);
+		if(fr != FR_OK) {
+			return fr;
+		}
+		if(f_size(&fil) == 0) {
+			f_printf(&fil, "test,kb,buffer,kb_per_s,us_per_op\n");
+		}
+		for(test = 0; test < 4; test++) {
+			f_printf(&fil, "%s,%ld,%u,%lu,%lu\n", diskbenchTests[test], kb, chunk, mos_benchRate(bytes[test], elapsed[test]), elapsed[test] * 10000 / ops[test]);
+		}
+		fr = f_close(&fil);
+	}
+	return fr;
+}
+
+// FREE
+// Parameters:
+// - ptr: Pointer to the argument string in the line edit buffer
+// Returns:
+// - MOS error code
+//
+int mos_cmdFREE(char * ptr) {
+	FATFS *	pfs;
+	DWORD	nclst;
+	DWORD	total;
+	char	label[12];
+	FRESULT	fr;
+
+	fr = f_getfree("", &nclst, &pfs);
+	if(fr == FR_OK) {
+		total = pfs->n_fatent - 2;
+		if(f_getlabel("", label, NULL) != FR_OK || label[0] == 0) {
+			strcpy(label, "NO NAME");
+		}
+		printf("Volume %s: %lu KB free of %lu KB\r\n", label, nclst * pfs->csize / 2, total * pfs->csize / 2);
+		printf("%lu of %lu clusters free, %u bytes per cluster\r\n", nclst, total, pfs->csize * 512);
+	}
+	return fr;
+}
+
+#if MOS_execHashSize > 0
+// REHASH
+// Parameters:
+// - ptr: Pointer to the argument string in the line edit buffer
+// Returns:
+// - MOS error code
+//
+int mos_cmdREHASH(char * ptr) {
+	int	count = mos_execRehash();
+
+	printf("%d commands found in /mos;%s\r\n", count, execPath);
+	return 0;
+}
+#endif
+
+#if MOS_starCacheSize > 0
+// CACHE [-f]
+// Parameters:
+// - ptr: Pointer to the argument string in the line edit buffer
+// Returns:
+// - MOS error code
+//
+int mos_cmdCACHE(char * ptr) {
+	char *	option;
+	int		i;
+
+	if(mos_parseString(NULL, &option)) {
+		if(strcasecmp(option, "-f") != 0) {
+			return FR_INVALID_PARAMETER;
+		}
+		mos_starCacheFlush();
+		return 0;
+	}
+	printf("Star command cache: %d bytes at &%06X, %lu hits, %lu misses\r\n", MOS_starCacheSize, STARCACHE_ADDRESS, starCacheHits, starCacheMisses);
+	for(i = 0; i < MOS_starCacheEntries; i++) {
+		if(starCache[i].path[0]) {
+			printf("&%06X %6d %s\r\n", STARCACHE_ADDRESS + starCache[i].offset, starCache[i].size, starCache[i].path);
+		}
+	}
+	return 0;
+}
+#endif
+
 // DIR command
 // Parameters:
 // - ptr: Pointer to the argument string in the line edit buffer
@@ -1028,12 +1720,23 @@ int mos_cmdMKDIR(char * ptr) {
 //
 int mos_cmdSET(char * ptr) {
 	char *	command;
+	char *	path;
 	UINT24 	value;
 	
-	if(
-		!mos_parseString(NULL, &command) ||
-		!mos_parseNumber(NULL, &value)
-	) {
+	if(!mos_parseString(NULL, &command)) {
+		return FR_INVALID_PARAMETER;
+	}
+	if(strcasecmp(command, "PATH") == 0) {
+		if(!mos_parseString(NULL, &path) || strlen(path) >= MOS_execPathLength) {
+			return FR_INVALID_PARAMETER;
+		}
+		strcpy(execPath, path);
+#if MOS_execHashSize > 0
+		mos_execRehash();
+#endif
+		return 0;
+	}
+	if(!mos_parseNumber(NULL, &value)) {
 		return FR_INVALID_PARAMETER;
 	}
 	if(strcasecmp(command, "KEYBOARD") == 0) {
@@ -1050,6 +1753,18 @@ int mos_cmdSET(char * ptr) {
 		putch(value & 0xFF);
 		return 0;
 	}
+	if(strcasecmp(command, "SDCRC") == 0 && value <= 1) {
+		if(SD_setCRC(value) != SD_SUCCESS) {
+			return FR_DISK_ERR;
+		}
+		return 0;
+	}
+	if(strcasecmp(command, "RXTRIGGER") == 0 && value <= 14) {
+		if(setTrigger_UART0(value) != UART_ERR_NONE) {
+			return FR_INVALID_PARAMETER;
+		}
+		return 0;
+	}
 	return FR_INVALID_PARAMETER;
 }
 
@@ -1182,6 +1897,19 @@ int mos_cmdMEM(char * ptr) {
 	}
 
 	printf("Largest free MOS:HEAP fragment: %d bytes\r\n", try_len);
+#if MOS_diskCacheSectors > 0
+	printf("Disk cache: %d sectors, %lu hits, %lu misses\r\n", MOS_diskCacheSectors, disk_cacheHits, disk_cacheMisses);
+#endif
+#if MOS_diskReadAhead > 0
+	printf("Read-ahead: %d sectors, %lu hits, %lu fetches\r\n", MOS_diskReadAhead, disk_readAheadHits, disk_readAheadFetches);
+#endif
+#if FF_FAT_CACHE > 0
+	printf("FAT cache: %d sectors, %lu hits, %lu misses\r\n", fs.fcbuf ? FF_FAT_CACHE : 0, fs.fchit, fs.fcmiss);
+#endif
+#if FF_DIR_CACHE > 0
+	printf("Path cache: %d entries, %lu hits, %lu misses\r\n", FF_DIR_CACHE, fs.dchit, fs.dcmiss);
+#endif
+	printf("UART0: trigger %d, %u interrupts, %u bytes received\r\n", uart0_rxTrigger, uart0_irqCount, uart0_rxCount);
 	printf("Sysvars at &%06x\r\n", sysvars);
 	printf("\r\n");
 
@@ -1374,6 +2102,19 @@ UINT24 mos_LOAD(char * filename, UINT24 address, UINT24 size) {
 	return fr;
 }
 
+// Allocate the clusters for a new file as one contiguous run, so that it
+// is written, and later read, with multiple block transfers
+// Parameters:
+// - fp: Pointer to a newly created, empty file
+// - size: Final size of the file
+// NB: If there is no contiguous run big enough the file grows as it is written
+//
+static void mos_preallocate(FIL * fp, FSIZE_t size) {
+	if(size > 0) {
+		f_expand(fp, size, 1);
+	}
+}
+
 // Save a file from memory to SD card
 // Parameters:
 // - filename: Path of file to save
@@ -1389,7 +2130,11 @@ UINT24	mos_SAVE(char * filename, UINT24 address, UINT24 size) {
 	
 	fr = f_open(&fil, filename, FA_WRITE | FA_CREATE_NEW);
 	if(fr == FR_OK) {
+		mos_preallocate(&fil, size);
 		fr = f_write(&fil, (void *)address, size, &br);
+		if(fr != FR_OK) {
+			f_truncate(&fil);
+		}
 	}
 	f_close(&fil);	
 	return fr;
@@ -1404,25 +2149,21 @@ UINT24	mos_SAVE(char * filename, UINT24 address, UINT24 size) {
 UINT24 mos_TYPE(char * filename) {
 	FRESULT	fr;
 	FIL		fil;
-	UINT   	br;
-	char	buf[512];
-	int		i;
+	UINT   	bf;
 
 	fr = f_open(&fil, filename, FA_READ);
 	if (fr != FR_OK) {
 		return fr;
 	}
 
-	while (1) {
-		fr = f_read(&fil, (void *)buf, sizeof buf, &br);
-		if (br == 0)
+	while (fr == FR_OK && !f_eof(&fil)) {
+		fr = f_forward(&fil, UART0_writeBlock, 0x8000, &bf);
+		if (bf == 0)
 			break;
-		for (i = 0; i < br; ++i)
-			putchar(buf[i]);
 	}
 
 	f_close(&fil);
-	return FR_OK;
+	return fr;
 }
 
 // Change directory
@@ -1435,6 +2176,7 @@ UINT24	mos_CD(char *path) {
 	FRESULT	fr;
 
 	fr = f_chdir(path);
+	f_getcwd(cwd, sizeof(cwd)); //Update full path.
 	return fr;
 }
 
@@ -1648,11 +2390,8 @@ UINT24 mos_DIR(char* inputPath, BOOL longListing) {
     }
 
     if (useColour) {
-        readPalette(128, TRUE);
-        textFg = scrpixelIndex;
+        getTextColours(&textFg, &textBg);
         fileColour = textFg;
-        readPalette(129, TRUE);
-        textBg = scrpixelIndex;
         while (dirColour == textBg || dirColour == fileColour) {
             dirColour = (dirColour + 1) % scrcolours;
         }
@@ -1671,7 +2410,6 @@ UINT24 mos_DIR(char* inputPath, BOOL longListing) {
         printf("\n\r");
 
         if (strcmp(dirPath, ".") == 0) {
-            f_getcwd(cwd, sizeof(cwd));
             printf("Directory: %s\r\n\r\n", cwd);
         } else
             printf("Directory: %s\r\n\r\n", dirPath);
@@ -1774,6 +2512,7 @@ UINT24 mos_DIR(char* inputPath, BOOL longListing) {
 
     if (useColour) {
         printf("\x11%c", textFg);
+        keepTextColours();
     }
 
 cleanup:
@@ -2002,12 +2741,14 @@ UINT24 mos_COPY(char *srcPath, char *dstPath, BOOL verbose) {
             }
 
 			if (verbose) printf("Copying %s to %s\r\n", fullSrcPath, fullDstPath);
+			mos_preallocate(&fdst, f_size(&fsrc));
             while (1) {
                 fr = f_read(&fsrc, buffer, sizeof(buffer), &br);
                 if (br == 0 || fr != FR_OK) break;
                 fr = f_write(&fdst, buffer, br, &bw);
                 if (bw < br || fr != FR_OK) break;
             }
+			if (fr != FR_OK) f_truncate(&fdst);
 
             f_close(&fsrc);
             f_close(&fdst);
@@ -2049,12 +2790,14 @@ UINT24 mos_COPY(char *srcPath, char *dstPath, BOOL verbose) {
         }
 
 		if (verbose) printf("Copying %s to %s\r\n", srcPath, fullDstPath);
+		mos_preallocate(&fdst, f_size(&fsrc));
         while (1) {
             fr = f_read(&fsrc, buffer, sizeof(buffer), &br);
             if (br == 0 || fr != FR_OK) break;
             fr = f_write(&fdst, buffer, br, &bw);
             if (bw < br || fr != FR_OK) break;
         }
+		if (fr != FR_OK) f_truncate(&fdst);
 
         f_close(&fsrc);
         f_close(&fdst);
@@ -2111,6 +2854,91 @@ UINT24 mos_EXEC(char * filename, char * buffer, UINT24 size) {
 	return fr;	
 }
 
+#if FF_FILX
+// Find the extension of a file object (called by FatFs)
+// Only the files opened with mos_FOPEN have one, so the FIL used by programs through the API keeps its size
+// Parameters:
+// - fp: Pointer to the file structure
+// Returns:
+// - Pointer to the extension, or NULL if the file has none
+//
+FILX * ff_filext(FIL * fp) {
+	int	i;
+
+	for(i = 0; i < MOS_maxOpenFiles; i++) {
+		if(fp == &mosFileObjects[i].fileObject) {
+			return &mosFileObjects[i].fileExt;
+		}
+	}
+	return NULL;
+}
+#endif
+
+#if FF_USE_FASTSEEK
+// Release the cluster link map table of a file, returning it to normal seek mode
+// Parameters:
+// - fo: Pointer to the file structure
+//
+static void mos_fastSeekClose(FIL * fo) {
+	FILX *	fx = ff_filext(fo);
+
+	ff_memfree(fx->cltbl);
+	fx->cltbl = NULL;
+}
+
+// Build a cluster link map table for a large file, so that seeks look up
+// the cluster in the table rather than following the FAT chain from the start
+// Parameters:
+// - fo: Pointer to the file structure
+// - mode: File open mode
+// NB: Only files opened read-only get a table; in fast seek mode FatFs can't extend a file
+// NB: If the file is too fragmented, or there is not enough heap, it is left in normal seek mode
+//
+static void mos_fastSeekOpen(FIL * fo, UINT8 mode) {
+	FRESULT	fr;
+	DWORD *	tbl;
+	DWORD	len = MOS_fastSeekItems;
+
+	if((mode & FA_WRITE) || f_size(fo) <= MOS_fastSeekSize) {
+		return;
+	}
+	do {
+		tbl = ff_memalloc(len * sizeof(DWORD));		// FatFs frees it when the file is closed
+		if(tbl == NULL) {
+			return;
+		}
+		tbl[0] = len;
+		ff_filext(fo)->cltbl = tbl;
+		fr = f_lseek(fo, CREATE_LINKMAP);
+		if(fr != FR_OK) {
+			// On FR_NOT_ENOUGH_CORE, FatFs leaves the size needed in tbl[0]
+			len = (fr == FR_NOT_ENOUGH_CORE && len < tbl[0]) ? tbl[0] : 0;
+			mos_fastSeekClose(fo);
+		}
+	} while(fr != FR_OK && len > 0 && len <= MOS_fastSeekMaxItems);
+}
+#endif
+
+#if MOS_fileBuffers > 0 && FF_FS_TINY
+// Give a file its own sector buffer on its first unaligned access, so that
+// it doesn't have to share the FatFs window with the other open files
+// Parameters:
+// - fo: Pointer to the file structure
+// - len: Number of bytes about to be read or written
+// NB: If there is no room on the heap the file keeps using the shared window
+//
+static void mos_fileBuffer(FIL * fo, UINT24 len) {
+	BYTE *	buf;
+
+	if(ff_filext(fo)->buf == NULL && (f_tell(fo) % FF_MAX_SS || len % FF_MAX_SS)) {
+		buf = ff_memalloc(FF_MAX_SS);				// FatFs frees it when the file is closed
+		if(buf && f_setbuf(fo, buf) != FR_OK) {
+			ff_memfree(buf);
+		}
+	}
+}
+#endif
+
 // Open a file
 // Parameters:
 // - filename: Path of file to open
@@ -2127,6 +2955,9 @@ UINT24 mos_FOPEN(char * filename, UINT8 mode) {
 			fr = f_open(&mosFileObjects[i].fileObject, filename, mode);
 			if(fr == FR_OK) {
 				mosFileObjects[i].free = 1;
+#if FF_USE_FASTSEEK
+				mos_fastSeekOpen(&mosFileObjects[i].fileObject, mode);
+#endif
 				return i + 1;
 			}
 		}
@@ -2177,6 +3008,9 @@ UINT24	mos_FGETC(UINT8 fh) {
 
 	fo = (FIL *)mos_GETFIL(fh);
 	if(fo > 0) {
+#if MOS_fileBuffers > 0 && FF_FS_TINY
+		mos_fileBuffer(fo, 1);
+#endif
 		fr = f_read(fo, &c, 1, &br); 
 		if(fr == FR_OK) {
 			return	c | (fat_EOF(fo) << 8);
@@ -2194,6 +3028,9 @@ void	mos_FPUTC(UINT8 fh, char c) {
 	FIL * fo = (FIL *)mos_GETFIL(fh);
 
 	if(fo > 0) {
+#if MOS_fileBuffers > 0 && FF_FS_TINY
+		mos_fileBuffer(fo, 1);
+#endif
 		f_putc(c, fo);
 	}
 }
@@ -2212,6 +3049,9 @@ UINT24	mos_FREAD(UINT8 fh, UINT24 buffer, UINT24 btr) {
 	UINT	br = 0;
 
 	if(fo > 0) {
+#if MOS_fileBuffers > 0 && FF_FS_TINY
+		mos_fileBuffer(fo, btr);
+#endif
 		fr = f_read(fo, (const void *)buffer, btr, &br);
 		if(fr == FR_OK) {
 			return br;
@@ -2234,6 +3074,9 @@ UINT24	mos_FWRITE(UINT8 fh, UINT24 buffer, UINT24 btw) {
 	UINT	bw = 0;
 
 	if(fo > 0) {
+#if MOS_fileBuffers > 0 && FF_FS_TINY
+		mos_fileBuffer(fo, btw);
+#endif
 		fr = f_write(fo, (const void *)buffer, btw, &bw);
 		if(fr == FR_OK) {
 			return bw;
@@ -2378,6 +3221,25 @@ UINT8 fat_EOF(FIL * fp) {
 	return 0;
 }
 
+// Get the free space on a volume
+// Parameters:
+// - path: Path on the volume
+// - nclst: Pointer to a DWORD to receive the number of free clusters
+// - szclst: Pointer to a DWORD to receive the cluster size in bytes
+// Returns:
+// - fatfs error code
+//
+UINT8 fat_getfree(const TCHAR * path, DWORD * nclst, DWORD * szclst) {
+	FATFS *	pfs;
+	FRESULT	fr;
+
+	fr = f_getfree(path, nclst, &pfs);
+	if(fr == FR_OK) {
+		*szclst = (DWORD)pfs->csize * 512;
+	}
+	return fr;
+}
+
 // (Re-)mount the MicroSD card
 // Parameters:
 // - None
@@ -2387,6 +3249,17 @@ UINT8 fat_EOF(FIL * fp) {
 int mos_mount(void) {
 	int ret = f_mount(&fs, "", 1);			// Mount the SD card
 	f_getcwd(cwd, sizeof(cwd)); //Update full path.
+#if MOS_execHashSize > 0
+	if(ret == FR_OK) {
+		mos_execRehash();					// Build the command hash table for the new card
+	}
+	else {
+		execHashValid = 0;					// Nothing is known about the directories
+	}
+#endif
+#if MOS_starCacheSize > 0
+	mos_starCacheFlush();					// The card may have changed
+#endif
 	return ret;
 }
 
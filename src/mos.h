@@ -2,7 +2,7 @@
  * Title:			AGON MOS - MOS code
  * Author:			Dean Belfield
  * Created:			10/07/2022
- * Last Updated:	11/11/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 11/07/2022:		Removed mos_cmdBYE, Added mos_cmdLOAD
@@ -29,6 +29,13 @@
  * 30/05/2023:		Function mos_FGETC now returns EOF flag
  * 08/07/2023		Added mos_trim function
  * 11/11/2023:		Added mos_cmdHELP, mos_cmdTYPE, mos_cmdCLS, mos_cmdMOUNT
+ * 16/10/2026:		Added SDCRC to HELP_SET
+ *					Added mos_cmdDISKINFO, mos_cmdDISKBENCH
+ *					Added mos_cmdFREE, fat_getfree
+ *					Added mos_cmdREHASH, mos_execRehash, PATH to HELP_SET
+ *					Added mos_cmdCACHE
+ *					Added RXTRIGGER to HELP_SET
+ *					t_mosFileObject holds the FatFs file object extension
  */
 
 #ifndef MOS_H
@@ -48,8 +55,26 @@ typedef struct {
 typedef struct {
 	UINT8	free;
 	FIL		fileObject;
+#if FF_FILX
+	FILX	fileExt;			// FatFs data kept outside the FIL, see ff_filext
+#endif
 } t_mosFileObject;
 
+typedef struct {
+	WORD	hash;				// Hash of the command name in upper case (0 = empty slot)
+	BYTE	dirs;				// Bit n set: the command is in search directory n (bit 0 is /mos)
+} t_mosExecHash;
+
+typedef struct {
+	char	path[40];			// Path the star command was loaded from (empty = unused entry)
+	UINT24	offset;				// Offset of the image in the star command cache
+	UINT24	size;				// Size of the image, which is the size of the file
+	WORD	fdate;				// Modification date and time of the file
+	WORD	ftime;
+	WORD	sum;				// Checksum of the image, in case something has written over it
+	DWORD	used;				// When the entry was last used, for replacement
+} t_mosStarCache;
+
 /**
  * MOS-specific return codes
  * These extend the FatFS return codes FRESULT
@@ -74,6 +99,7 @@ char *	mos_strtok(char *s1, char * s2);
 char *	mos_strtok_r(char *s1, const char *s2, char **ptr);
 int		mos_exec(char * buffer, BOOL in_mos);
 UINT8 	mos_execMode(UINT8 * ptr);
+int		mos_execRehash(void);
 
 int		mos_mount(void);
 
@@ -82,6 +108,11 @@ BOOL	mos_parseString(char * ptr, char ** p_Value);
 
 int		mos_cmdDIR(char * ptr);
 int		mos_cmdDISC(char *ptr);
+int		mos_cmdDISKBENCH(char *ptr);
+int		mos_cmdDISKINFO(char *ptr);
+int		mos_cmdFREE(char *ptr);
+int		mos_cmdREHASH(char *ptr);
+int		mos_cmdCACHE(char *ptr);
 int		mos_cmdLOAD(char * ptr);
 int		mos_cmdSAVE(char *ptr);
 int		mos_cmdDEL(char * ptr);
@@ -139,6 +170,10 @@ extern TCHAR	cwd[256];
 extern BOOL	sdcardDelay;
 
 UINT8	fat_EOF(FIL * fp);
+UINT8	fat_getfree(const TCHAR * path, DWORD * nclst, DWORD * szclst);
+
+#define HELP_CACHE			"List the star commands held in RAM, or empty the cache\r\n"
+#define HELP_CACHE_ARGS		"[-f]"
 
 #define HELP_CAT			"Directory listing of the current directory\r\n"
 #define HELP_CAT_ARGS		"[-l] <path>"
@@ -155,12 +190,21 @@ UINT8	fat_EOF(FIL * fp);
 #define HELP_DELETE			"Delete a file or folder (must be empty)\r\n"
 #define HELP_DELETE_ARGS	"[-f] <filename>"
 
+#define HELP_DISKBENCH		"Measure SD card read and write speed using a temporary file.\r\n" \
+							"The size of the file defaults to 256KB. The results can be\r\n" \
+							"appended to a CSV file for comparison\r\n"
+#define HELP_DISKBENCH_ARGS	"[<kb> [<csvfile>]]"
+
+#define HELP_DISKINFO		"Show the SD card type, manufacturer, capacity and speed class\r\n"
+
 #define HELP_ECHO			"Echo sends a string to the VDU, after transformation\r\n"
 #define HELP_ECHO_ARGS		"<string>"
 
 #define HELP_EXEC			"Run a batch file containing MOS commands\r\n"
 #define HELP_EXEC_ARGS		"<filename>"
 
+#define HELP_FREE			"Show the free space on the SD card\r\n"
+
 #define HELP_JMP			"Jump to the specified address in memory\r\n"
 #define HELP_JMP_ARGS		"<addr>"
 
@@ -177,6 +221,9 @@ UINT8	fat_EOF(FIL * fp);
 #define HELP_PRINTF			"Print a string to the VDU, with common unix-style escapes\r\n"
 #define HELP_PRINTF_ARGS	"<string>"
 
+#define HELP_REHASH			"Rebuild the table of commands found in /mos\r\n" \
+							"and the directories on the search path\r\n"
+
 #define HELP_RENAME			"Rename a file in the same folder\r\n"
 #define HELP_RENAME_ARGS	"<filename1> <filename2>"
 
@@ -213,7 +260,20 @@ UINT8	fat_EOF(FIL * fp);
 							"Serial Console\r\n" \
 							"SET CONSOLE n: Serial console\r\n" \
 							"    0: Console off (default)\r\n" \
-							"    1: Console on\r\n"
+							"    1: Console on\r\n" \
+							"\r\n" \
+							"SD Card CRC Checking\r\n" \
+							"SET SDCRC n: Check the CRC of SD card transfers\r\n" \
+							"    0: CRC checking off (default)\r\n" \
+							"    1: CRC checking on, re-read blocks that fail\r\n" \
+							"\r\n" \
+							"VDP Receive Trigger Level\r\n" \
+							"SET RXTRIGGER n: Bytes received from the VDP before\r\n" \
+							"    an interrupt: 1, 4, 8 (default) or 14\r\n" \
+							"\r\n" \
+							"Command Search Path\r\n" \
+							"SET PATH dirs: Directories searched after /mos for\r\n" \
+							"    commands, separated by ';' (default .;/bin)\r\n"
 #define HELP_SET_ARGS		"<option> <value>"
 
 #define HELP_TIME			"Set and read the ESP32 real-time clock\r\n"
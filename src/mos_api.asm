@@ -2,7 +2,7 @@
 ; Title:	AGON MOS - API code
 ; Author:	Dean Belfield
 ; Created:	24/07/2022
-; Last Updated:	10/11/2023
+; Last Updated:	16/10/2026
 ;
 ; Modinfo:
 ; 03/08/2022:	Added a handful of MOS API calls and stubbed FatFS calls
@@ -24,6 +24,9 @@
 ; 03/08/2023:	Added mos_api_setkbvector
 ; 10/08/2023:	Added mos_api_getkbmap
 ; 10/11/2023:	Added mos_api_i2c_close, mos_api_i2c_open, mos_api_i2c_read, mos_api_i2c_write
+; 16/10/2026:	Added ffs_api_fexpand
+;		Added ffs_api_fforward
+;		Added ffs_api_getfree
 
 
 			.ASSUME	ADL = 1
@@ -67,12 +70,14 @@
 			XREF	_mos_I2C_READ
 			
 			XREF	_fat_EOF		; In mos.c
+			XREF	_fat_getfree
 
 			XREF	_open_UART1		; In uart.c
 			XREF	_close_UART1
 
 			XREF	UART1_serial_GETCH	; In serial.asm
 			XREF	UART1_serial_PUTCH 
+			XREF	_UART0_writeBlock
 			
 			XREF	_keyascii		; In globals.asm
 			XREF	_keycount
@@ -90,6 +95,8 @@
 			XREF	_f_stat 
 			XREF	_f_lseek
 			XREF	_f_truncate
+			XREF	_f_expand
+			XREF	_f_forward
 			XREF	_f_opendir
 			XREF	_f_closedir
 			XREF	_f_readdir
@@ -1186,15 +1193,74 @@ $$:			PUSH	HL		; FIL * fp
 			POP	HL		
 			RET 
 
+; Allocate a contiguous block of clusters to an empty file
+; HLU: Pointer to a FIL struct
+; DEU: Least significant 3 bytes of the size to allocate (DWORD)
+;   C: Most significant byte of the size
+;   B: 0 to prepare the allocation for writes, 1 to allocate now
+; Returns:
+;   A: FRESULT
+;
+ffs_api_fexpand:	LD	A, MB
+			OR	A, A 
+			JR	Z, $F
+			CALL	GET_AHL24
+			OR 	A, A 
+			LD	A, MB
+			CALL	Z, SET_AHL24
+;
+$$:			LD	A, C		; A: Most significant byte of the size
+			LD	C, B
+			PUSH	BC		; BYTE opt
+			LD	C, A
+			PUSH	BC		; FSIZE_t fsz (msb)
+			PUSH	DE		; FSIZE_t fsz (lsw)
+			PUSH	HL		; FIL * fp
+			CALL	_f_expand 
+			LD	A, L
+			POP	HL		
+			POP	DE
+			POP	BC
+			INC	SP		; Discard opt
+			INC	SP
+			INC	SP
+			RET 
+
+; Forward data from a file straight to the VDP (UART0)
+; HLU: Pointer to a FIL struct
+; DEU: Number of bytes to forward
+; Returns:
+;   A: FRESULT
+; BCU: Number of bytes forwarded
+;
+ffs_api_fforward:	LD	A, MB		; A: MB
+			OR	A, A 		; Check whether MB is 0, i.e. in 24-bit mode
+			JR	Z, $F		; It is, so skip as all addresses can be assumed to be 24-bit
+			CALL	GET_AHL24	; Get MSB of HL
+			OR	A, A 		; Does it already contain a value? (fetched using mos_api_getfil?)
+			LD	A, MB		; A: MB
+			CALL	Z, SET_AHL24	; No it's zero, so convert HL to an address in segment A (MB)
+;
+$$:			LD	BC, _scratchpad
+			PUSH	BC		; UINT * bf
+			PUSH	DE		; UINT btf
+			LD	BC, _UART0_writeBlock
+			PUSH	BC		; UINT (*func)(const BYTE *, UINT)
+			PUSH	HL		; FIL * fp
+			CALL	_f_forward
+			LD	A, L 		; FRESULT
+			POP	HL
+			POP	BC
+			POP	DE
+			POP	BC
+			LD	BC, (_scratchpad)
+			RET 
+
 ;		
 ; Commands that have not been implemented yet
 ;
 ffs_api_fsync:		
 			JP mos_api_not_implemented
-ffs_api_fforward:	
-			JP mos_api_not_implemented
-ffs_api_fexpand:	
-			JP mos_api_not_implemented
 ffs_api_fgets:		
 			JP mos_api_not_implemented
 ffs_api_fputc:		
@@ -1305,8 +1371,37 @@ ffs_api_mkfs:
 			JP mos_api_not_implemented
 ffs_api_fdisk		
 			JP mos_api_not_implemented
-ffs_api_getfree:	
-			JP mos_api_not_implemented
+
+; Get the free space on a volume
+; HLU: Pointer to the path (0 terminated)
+; DEU: Pointer to a DWORD to receive the number of free clusters
+; BCU: Pointer to a DWORD to receive the cluster size in bytes
+; Returns:
+; A: FRESULT
+ffs_api_getfree:	LD	A, MB		; A: MB
+			OR	A, A 		; Check whether MB is 0, i.e. in 24-bit mode
+			JR	Z, $F		; It is, so skip as all addresses can be assumed to be 24-bit
+			CALL 	SET_ADE24	; Convert DE to an address in segment A (MB)
+			PUSH	BC
+			EX	(SP), HL
+			CALL	SET_AHL24	; Convert BC to an address in segment A (MB)
+			EX	(SP), HL
+			POP	BC
+			CALL	GET_AHL24	; Get MSB of HL
+			OR	A, A 		; Does it already contain a value?
+			LD	A, MB		; A: MB
+			CALL	Z, SET_AHL24	; No it's zero, so convert HL to an address in segment A (MB)
+$$:
+			PUSH	BC		; DWORD *szclst
+			PUSH	DE		; DWORD *nclst
+			PUSH	HL		; const TCHAR *path
+			CALL	_fat_getfree
+			LD	A, L		; FRESULT
+			POP	HL
+			POP	DE
+			POP	BC
+			RET
+
 ffs_api_getlabel:	
 			JP mos_api_not_implemented
 ffs_api_setlabel:	
@@ -2,7 +2,7 @@
  * Title:			AGON MOS - MOS line editor
  * Author:			Dean Belfield
  * Created:			18/09/2022
- * Last Updated:	31/03/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 28/09/2022:		Added clear parameter to mos_EDITLINE
@@ -12,6 +12,9 @@
  * 21/03/2023:		Improved backspace, and editing of long lines, after scroll, at bottom of screen
  * 22/03/2023:		Added a single-entry command line history
  * 31/03/2023:		Added timeout for VDP protocol
+ * 16/10/2026:		VDP requests wait on their own reply's sequence counter
+ *					Cursor position, mode and text colours come from the shadow VDP state when it is up to date
+ *					getCursorPos and getModeInformation mark the shadow valid only when the reply can be trusted
  */
 
 #include <eZ80.h>
@@ -40,6 +43,37 @@ extern volatile BYTE history_size;
 extern BYTE cursorX;
 extern BYTE cursorY;
 extern BYTE scrcols;
+extern BYTE scrpixelIndex;
+
+extern volatile BYTE vdp_shadow;				// In globals.asm
+extern volatile BYTE vdp_txcount;				// In globals.asm
+
+static BYTE	textFg;								// Shadow copy of the text colours
+static BYTE	textBg;
+static BOOL	cursorLost;							// A cursor request timed out, so its reply may still turn up
+static BOOL	modeLost;							// A mode request timed out, so its reply may still turn up
+
+// Decide whether a reply to a VDP request can become the shadow copy
+// It can if nothing else has been sent since the request, and no earlier request
+// is still unanswered (its late reply would be mistaken for this one)
+// Parameters:
+// - ok: TRUE if the reply came in
+// - tx: vdp_txcount just after the request was sent
+// - lost: Set while an earlier request is unanswered
+// Returns:
+// - TRUE if the reply can be trusted
+//
+static BOOL trustReply(BOOL ok, BYTE tx, BOOL * lost) {
+	if(!ok) {
+		*lost = TRUE;
+		return FALSE;
+	}
+	if(*lost) {
+		*lost = FALSE;							// Assume that was the late reply; trust the next one
+		return FALSE;
+	}
+	return vdp_txcount == tx;
+}
 
 // Storage for the command history
 //
@@ -48,44 +82,96 @@ static char	* cmd_history[cmd_historyDepth];
 char *hotkey_strings[12] = NULL; 
 
 // Get the current cursor position from the VPD
+// If the shadow copy is up to date, then there is no need to ask
 //
 void getCursorPos() {
+	BYTE	seq = vdp_protocol_seq[VDPP_SEQ_CURSOR];
+	BYTE	tx;
+
+	if(vdp_shadow & VDPS_CURSOR) {
+		return;
+	}
 	vpd_protocol_flags &= 0xFE;					// Clear the semaphore flag
 	putch(23);									// Request the cursor position
 	putch(0);
 	putch(VDP_cursor);
-	wait_VDP(0x01);								// Wait until the semaphore has been set, or a timeout happens
+	tx = vdp_txcount;
+	if(trustReply(wait_VDPreply(VDPP_SEQ_CURSOR, seq), tx, &cursorLost)) {	// Wait until the reply comes in, or a timeout happens
+		vdp_shadow |= VDPS_CURSOR;
+	}
 }
 
 // Get the current screen dimensions from the VDU
+// If the shadow copy is up to date, then there is no need to ask
 //
 void getModeInformation() {
+	BYTE	seq = vdp_protocol_seq[VDPP_SEQ_MODE];
+	BYTE	tx;
+
+	if(vdp_shadow & VDPS_MODE) {
+		return;
+	}
 	vpd_protocol_flags &= 0xEF;					// Clear the semaphore flag
 	putch(23);
 	putch(0);
 	putch(VDP_mode);
-	wait_VDP(0x10);								// Wait until the semaphore has been set, or a timeout happens
+	tx = vdp_txcount;
+	if(trustReply(wait_VDPreply(VDPP_SEQ_MODE, seq), tx, &modeLost)) {	// Wait until the reply comes in, or a timeout happens
+		vdp_shadow |= VDPS_MODE;
+	}
 }
 
 // Get palette entry
 //
 void readPalette(BYTE entry, BOOL wait) {
+	BYTE	seq = vdp_protocol_seq[VDPP_SEQ_POINT];
+
 	vpd_protocol_flags &= 0xFB;					// Clear the semaphore flag
 	putch(23);
 	putch(0);
 	putch(VDP_palette);
 	putch(entry);
 	if (wait) {
-		wait_VDP(0x04);							// Wait until the semaphore has been set, or a timeout happens
+		wait_VDPreply(VDPP_SEQ_POINT, seq);		// Wait until the reply comes in, or a timeout happens
 	}
 }
 
+// Get the text colours
+// If the shadow copy is up to date, then there is no need to ask
+// Parameters:
+// - fg: Set to the palette index of the text foreground colour
+// - bg: Set to the palette index of the text background colour
+//
+void getTextColours(BYTE * fg, BYTE * bg) {
+	if((vdp_shadow & VDPS_COLOURS) == 0) {
+		readPalette(128, TRUE);
+		textFg = scrpixelIndex;
+		readPalette(129, TRUE);
+		textBg = scrpixelIndex;
+		vdp_shadow |= VDPS_COLOURS;
+	}
+	*fg = textFg;
+	*bg = textBg;
+}
+
+// Mark the shadow copy of the text colours as up to date again
+// For callers that change the colours and then put back those from getTextColours
+//
+void keepTextColours() {
+	vdp_shadow |= VDPS_COLOURS;
+}
+
 // Move cursor left
 //
 void doLeftCursor() {
+	BYTE	valid;
+
 	getCursorPos();
+	valid = vdp_shadow & VDPS_CURSOR;
 	if(cursorX > 0) {
 		putch(0x08);
+		cursorX--;								// Keep the shadow copy up to date, if it was
+		vdp_shadow |= valid;
 	}
 	else {
 		while(cursorX < (scrcols - 1)) {
@@ -99,9 +185,14 @@ void doLeftCursor() {
 // Move Cursor Right
 // 
 void doRightCursor() {
+	BYTE	valid;
+
 	getCursorPos();
+	valid = vdp_shadow & VDPS_CURSOR;
 	if(cursorX < (scrcols - 1)) {
 		putch(0x09);
+		cursorX++;								// Keep the shadow copy up to date, if it was
+		vdp_shadow |= valid;
 	}
 	else {
 		while(cursorX > 0) {
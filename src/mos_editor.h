@@ -2,11 +2,12 @@
  * Title:			AGON MOS - MOS line editor
  * Author:			Dean Belfield
  * Created:			18/09/2022
- * Last Updated:	22/03/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 28/09/2022:		Added clear parameter to mos_EDITLINE
  * 22/03/2023:		Added defines for command history
+ * 16/10/2026:		Added getTextColours, keepTextColours
  */
 
 #ifndef MOS_EDITOR_H
@@ -18,6 +19,8 @@
 UINT24	mos_EDITLINE(char * filename, int bufferLength, UINT8 clear);
 void getModeInformation();
 void readPalette(BYTE entry, BOOL wait);
+void getTextColours(BYTE * fg, BYTE * bg);
+void keepTextColours();
 
 void editHistoryInit();
 void editHistoryPush(char *buffer);
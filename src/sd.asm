@@ -2,10 +2,17 @@
 ; Title:	AGON MOS - SD card low level assembly language
 ; Author:	Leigh Brown
 ; Created:	26/05/2023
-; Last Updated:	26/05/2023
+; Last Updated:	16/10/2026
 
 ; Modinfo
-;
+; 16/10/2026:	SD_readBlocks uses CMD18 when reading more than one block
+;		SD_writeBlocks uses ACMD23 and CMD25 when writing more than one block
+;		Writes no longer wait for the card to finish programming; the busy
+;		check is deferred to the next command or SD_sync
+;		Added SD_readCSD and SD_erase
+;		Added optional CRC checking of commands and data blocks (CMD59)
+;		Data blocks use spi_readBlock and spi_writeBlock
+;		Added SD_readCID and SD_readSDStatus, exported SD_readOCR
 
 		INCLUDE "ez80F92.inc"
 		INCLUDE	"equs.inc"
@@ -23,22 +30,36 @@ SD_INIT_CYCLES		.equ	10
 SD_START_TOKEN	.equ	%FE
 SD_ERROR_TOKEN	.equ	%00
 
+SD_MULTI_START_TOKEN	.equ	%FC
+SD_STOP_TRAN_TOKEN	.equ	%FD
+
 SD_DATA_ACCEPTED	.equ	%05
 SD_DATA_REJECTED_CRC	.equ	%0B
 SD_DATA_REJECTED_WRITE	.equ	%0D
 
 SD_BLOCK_LEN	.equ	512
 
+SD_CRC_TRIES	.equ	4	; Number of times a block is read before a CRC mismatch is an error
+
 SD_CMD_LEN	.equ	6
 
 		XDEF		_SD_init
 		XDEF		_SD_readBlocks
 		XDEF		_SD_writeBlocks
+		XDEF		_SD_sync
+		XDEF		_SD_readCSD
+		XDEF		_SD_erase
+		XDEF		_SD_setCRC
+		XDEF		_SD_readCID
+		XDEF		_SD_readSDStatus
+		XDEF		_SD_readOCR
 
 		XREF		_spi_transfer
 		XREF		_spi_read_one
 		XREF		_spi_read
 		XREF		_spi_write
+		XREF		spi_readBlock
+		XREF		spi_writeBlock
 		XREF		_sdcardDelay
 
 		.ASSUME ADL = 1
@@ -63,6 +84,10 @@ _SD_init:
 		ADD		HL,SP
 		LD		SP,HL
 
+		; Forget about any write left in progress
+		XOR		A,A
+		LD		(sd_busy),A
+
 		; Off we go
 		CALL		_SD_powerUpSeq
 
@@ -125,7 +150,12 @@ $success2:	PEA		IX-6
 $out_error:	LD		A,SD_ERROR
 		JR		$exit
 
-$out_success:	XOR		A,A	; LD A,LD_SUCCESS
+		; Resetting the card turned CRC checking off, so turn it back on
+$out_success:	LD		A,(sd_crc)
+		OR		A,A
+		CALL		NZ,SD_sendCRCMode
+
+		XOR		A,A	; LD A,LD_SUCCESS
 $exit:		LD		SP,IX
 		POP		IX
 		RET
@@ -135,6 +165,8 @@ $exit:		LD		SP,IX
 ;		     IX+6        IX+12      IX+15
 ;
 ; Local variables:
+;	IX-6		tries left before a CRC mismatch is an error
+;	IX-4		CRC mismatch flag, set by SD_readCRC
 ;	IX-3/IX-2	Reserved for SD_readSingleBlock
 ;	IX-1		token
 
@@ -145,13 +177,28 @@ _SD_readBlocks:
 		PUSH		IX
 		LD		IX,0
 		ADD		IX,SP
-		PUSH		BC	; 3 bytes for local variables
+		PUSH		BC	; 6 bytes for local variables
+		PUSH		BC
 
 		; sign-extend count (it's unsigned, so set top byte to 0)
 		LD		(IX+17),0
 
-		; HL := count, then jump to the check for zero
+		LD		(IX-6),SD_CRC_TRIES
+
+		; (Re)start from the current sector, buf and count
+$again:		LD		(IX-4),0
+
+		; HL := count
 		LD		HL,(IX+15)
+
+		; Use a single CMD18 for more than one block
+		LD		DE,2
+		OR		A,A
+		SBC		HL,DE
+		JR		NC,$multi
+
+		; Otherwise restore HL := count, then jump to the check for zero
+		ADD		HL,DE
 		JR		$start
 		
 		; Read current block
@@ -165,6 +212,11 @@ $loop:		CALL		SD_readSingleBlock
 		LD		A,(IX-1)
 		CP		A,%FE
 		JR		NZ,$err_exit
+
+		; Read the block again if the CRC didn't match
+		LD		A,(IX-4)
+		OR		A,A
+		JR		NZ,$retry
 		
 		; Update sector, buf and count
 		; HL is set to the updated value of count
@@ -183,6 +235,19 @@ $exit:		LD		SP,IX
 $err_exit:	LD		A,SD_ERROR
 		JR		$exit
 
+		; Multiple block read, returns SD_SUCCESS or SD_ERROR in A
+$multi:		CALL		SD_readMultipleBlocks
+		OR		A,A
+		JR		Z,$exit
+
+		; On a CRC mismatch, carry on from the block that failed
+		LD		A,(IX-4)
+		OR		A,A
+		JR		Z,$err_exit
+$retry:		DEC		(IX-6)
+		JR		NZ,$again
+		JR		$err_exit
+
 ; Delay by 30ms. Roughly how long an old 5.25" disk takes to read 512 bytes
 SD_delayDisc:
 		LD		A, (_sdcardDelay)
@@ -249,17 +314,16 @@ $out1:		TIMER_RESET	0		; (clobbers just A)
 		JR		NZ,$out3
 
 		; Read the sector
-		LD		BC,SD_BLOCK_LEN
-		PUSH		BC
-		LD		BC,(IX+12)	; buf
-		PUSH		BC
-		CALL		_spi_read
-		POP		BC
-		POP		BC
+		LD		HL,(IX+12)	; buf
+		CALL		spi_readBlock
+		JR		NC,$crc
 
-		; Read and discard the two CRC bytes
-		CALL		_spi_read_one
-		CALL		_spi_read_one
+		; SPI timed out: *token = 0xFF
+		LD		(IX-1),%FF
+		JR		$out3
+
+		; Read the two CRC bytes
+$crc:		CALL		SD_readCRC
 
 		; Deassert chip select
 $out3:		CALL		_SD_CS_disable
@@ -269,6 +333,139 @@ $out3:		CALL		_SD_CS_disable
 		RET
 
 
+; SD_readMultipleBlocks
+
+; This does not use the C calling-convention.
+; It uses the stack frame pointer and local space set up by _SD_readBlocks
+;
+; Reads all count blocks with a single CMD18, then stops with CMD12
+;
+; Output: A := SD_SUCCESS or SD_ERROR
+
+		SCOPE
+
+SD_readMultipleBlocks:
+		CALL	SD_delayDisc
+		LD		(IX-3),CMD18     | %40
+		LD		(IX-2),CMD18_CRC | %01
+
+		CALL		SD_sendIOCmd	; Sets *token to 0xFF too
+		CP		A,2		; Exit with SD_ERROR if res1 >= 2
+		JR		NC,$err_out
+
+		; Wait for a start token (timeout = 100ms)
+$loop:		TIMER_SET	0,100
+		TIMER_START	0
+
+$loop1:		CALL		_spi_read_one
+		LD		B,A		; Move byte read to B
+		CP		A,%FF
+		JR		NZ,$out1
+
+		; Continue until the timer expires
+		TIMER_EXP?	0		; (clobbers just A)
+		JR		NC,$loop1
+
+$out1:		TIMER_RESET	0		; (clobbers just A)
+
+		; *token = read
+		LD		(IX-1),B
+
+		; Stop the transfer if the response token is not 0xFE
+		LD		A,SD_START_TOKEN
+		CP		A,B
+		JR		NZ,$stop
+
+		; Read the sector
+		LD		HL,(IX+12)	; buf
+		CALL		spi_readBlock
+		JR		C,$bad_block
+
+		; Read the two CRC bytes, stop the transfer if they don't match
+		CALL		SD_readCRC
+		LD		A,(IX-4)
+		OR		A,A
+		JR		NZ,$bad_block
+
+		; Update sector, buf and count
+		; HL is set to the updated value of count
+		CALL		SD_updateIOVars
+		LD		A,H
+		OR		A,L
+		JR		Z,$stop
+
+		CALL		SD_delayDisc
+		JR		$loop
+
+		; SPI timeout or CRC mismatch
+$bad_block:	LD		(IX-1),%FF
+
+		; Stop the transfer; the result depends on the last token read
+$stop:		CALL		SD_stopTransmission
+		LD		A,(IX-1)
+		CP		A,SD_START_TOKEN
+		LD		A,SD_SUCCESS
+		JR		Z,$out
+
+$err_out:	LD		A,SD_ERROR
+
+		; Deassert chip select
+$out:		PUSH		AF
+		CALL		_SD_CS_disable
+		POP		AF
+		RET
+
+
+; SD_stopTransmission
+;
+; Send CMD12 to end a multiple block transfer, then wait for the card to
+; release busy. Chip select must already be asserted.
+;
+; Output: A := %FF if the card is ready
+
+		SCOPE
+
+SD_stopTransmission:
+		LD		HL,SD_CMD_LEN
+		PUSH		HL
+		LD		HL,cmd12_string
+		PUSH		HL
+		CALL		_spi_write
+		POP		HL
+		POP		HL
+
+		; Discard the stuff byte that follows CMD12, then read R1b
+		CALL		_spi_read_one
+		CALL		_SD_readRes1
+		; Fall through to SD_waitReady
+
+
+; SD_waitReady
+;
+; Wait for the card to release busy (timeout = 250ms)
+;
+; Output: A := last byte read (%FF if the card is ready)
+
+		SCOPE
+
+SD_waitReady:
+		TIMER_SET	0,250
+		TIMER_START	0
+
+$loop:		CALL		_spi_read_one
+		LD		B,A		; Save byte read
+		INC		A		; Card is ready when it reads 0xFF
+		JR		Z,$done
+
+		; Continue until the timer expires
+		TIMER_EXP?	0		; (clobbers just A)
+		JR		NC,$loop
+
+$done:		TIMER_RESET	0		; (clobbers just A)
+		LD		A,B
+		RET
+
+
 ; BYTE SD_writeBlocks(DWORD addr, BYTE *buf, WORD count)
 ;		     IX+6        IX+12      IX+15
 ;
@@ -288,8 +485,17 @@ _SD_writeBlocks:
 		; sign extend count (it's unsigned, so set top byte to 0)
 		LD		(IX+17),0
 
-		; HL := count, then jump to the check for zero
+		; HL := count
 		LD		HL,(IX+15)
+
+		; Use a single CMD25 for more than one block
+		LD		DE,2
+		OR		A,A
+		SBC		HL,DE
+		JR		NC,$multi
+
+		; Otherwise restore HL := count, then jump to the check for zero
+		ADD		HL,DE
 		JR		$start
 
 $loop:		CALL		SD_writeSingleBlock
@@ -320,6 +526,10 @@ $exit:		LD		SP,IX
 $err_exit:	LD		A,SD_ERROR
 		JR		$exit
 
+		; Multiple block write, returns SD_SUCCESS or SD_ERROR in A
+$multi:		CALL		SD_writeMultipleBlocks
+		JR		$exit
+
 
 ; SD_writeSingleBlock
 
@@ -347,13 +557,12 @@ SD_writeSingleBlock:
 		POP		BC
 
 		; Write buffer to card
-		LD		BC,SD_BLOCK_LEN
-		PUSH		BC
-		LD		BC,(IX+12)
-		PUSH		BC
-		CALL		_spi_write
-		POP		BC
-		POP		BC
+		LD		HL,(IX+12)
+		CALL		spi_writeBlock
+		JR		C,$out3		; SPI timed out, *token is still 0xFF
+
+		; Send the two CRC bytes
+		CALL		SD_writeCRC
 
 		; Wait for a response token (timeout = 250ms)
 		TIMER_SET	0,250
@@ -381,33 +590,410 @@ $gotit1:	TIMER_RESET	0		; (clobbers just A)
 		; *token = 0x05 (conveniently left in register A)
 		LD		(IX-1),A
 
-		; Wait for write to finish (timeout = 250ms)
+		; Don't wait for the write to finish; the card stays busy
+		; whilst deselected and the next command checks for it
+		LD		A,1
+		LD		(sd_busy),A
+
+		; Deassert chip select
+$out3:		CALL		_SD_CS_disable
+
+		; Restore res1 to return to caller
+		POP		AF
+		RET
+
+
+; SD_writeMultipleBlocks
+
+; This does not use the C calling-convention.
+; It uses the stack frame pointer and local space set up by _SD_writeBlocks
+;
+; Tells the card how many blocks are coming with ACMD23 so that it can
+; pre-erase them, writes all count blocks with a single CMD25, then ends
+; the transfer with a stop tran token
+;
+; Output: A := SD_SUCCESS or SD_ERROR
+
+		SCOPE
+
+SD_writeMultipleBlocks:
+		CALL		SD_delayDisc
+
+		; Pre-erase hint; it is only a hint so the response is ignored,
+		; but don't send ACMD23 unless the card has accepted CMD55
+		CALL		_SD_sendApp
+		CP		A,2
+		JR		NC,$cmd25
+
+		; sd_cmd_buffer := ACMD23 with the block count as its argument
+		LD		HL,sd_cmd_buffer
+		LD		(HL),ACMD23 | %40
+		INC		HL
+		LD		(HL),0
+		INC		HL
+		LD		(HL),0
+		INC		HL
+		LD		A,(IX+16)
+		LD		(HL),A
+		INC		HL
+		LD		A,(IX+15)
+		LD		(HL),A
+		INC		HL
+		LD		(HL),ACMD23_CRC | %01
+		CALL		SD_cmdBufferCRC
+		LD		BC,sd_cmd_buffer
+		CALL		SD_sendCmdReadRes1
+
+$cmd25:		LD		(IX-3),CMD25     | %40
+		LD		(IX-2),CMD25_CRC | %01
+
+		CALL		SD_sendIOCmd	; Sets *token to 0xFF too
+		OR		A,A		; Exit with SD_ERROR if res1 != 0x00
+		JR		NZ,$err_out
+
+		; Send start token
+$loop:		LD		C,SD_MULTI_START_TOKEN
+		PUSH		BC
+		CALL		_spi_transfer
+		POP		BC
+
+		; Write buffer to card
+		LD		HL,(IX+12)
+		CALL		spi_writeBlock
+		JR		C,$fail
+
+		; Send the two CRC bytes
+		CALL		SD_writeCRC
+
+		; Wait for a response token (timeout = 250ms)
 		TIMER_SET	0,250
 		TIMER_START	0
 
-$loop2:		CALL		_spi_read_one
-		CP		A,%00
-		JR		NZ,$gotit2
+$loop1:		CALL		_spi_read_one
+		LD		B,A		; Save byte read
+		CP		A,%FF
+		JR		NZ,$gotit1
 
 		; Continue until the timer expires
-		TIMER_EXP?	0
-		JR		NC,$loop2
+		TIMER_EXP?	0		; (clobbers just A)
+		JR		NC,$loop1
 
-		; Timeout, skip over setting token
-		JR		$notgot
+$gotit1:	TIMER_RESET	0		; (clobbers just A)
 
-$gotit2:	; Success: set token to 0x00
-		XOR		A,A
+		; *token = data response
+		LD		A,%1F
+		AND		A,B
+		LD		(IX-1),A
+
+		; Stop the transfer unless the data was accepted
+		CP		A,SD_DATA_ACCEPTED
+		JR		NZ,$stop
+
+		; Wait for the card to finish programming the block
+		CALL		SD_waitReady
+		INC		A
+		JR		NZ,$fail
+
+		; Update sector, buf and count
+		; HL is set to the updated value of count
+		CALL		SD_updateIOVars
+		LD		A,H
+		OR		A,L
+		JR		Z,$stop
+
+		CALL		SD_delayDisc
+		JR		$loop
+
+		; Card still busy after timeout, or SPI timed out; record it as
+		; a failure
+$fail:		LD		(IX-1),%FF
+
+		; Stop the transfer and skip a byte. The card then programs
+		; the last block; that busy check is left to the next command
+$stop:		LD		C,SD_STOP_TRAN_TOKEN
+		PUSH		BC
+		CALL		_spi_transfer
+		POP		BC
+		CALL		_spi_read_one
+		LD		A,1
+		LD		(sd_busy),A
+
+		; The result depends on the last data response
 		LD		A,(IX-1)
+		CP		A,SD_DATA_ACCEPTED
+		LD		A,SD_SUCCESS
+		JR		Z,$out
 
-$notgot:	; Reset the timer
-		TIMER_RESET	0
+$err_out:	LD		A,SD_ERROR
 
 		; Deassert chip select
-$out3:		CALL		_SD_CS_disable
+$out:		PUSH		AF
+		CALL		_SD_CS_disable
+		POP		AF
+		RET
 
-		; Restore res1 to return to caller
+
+; BYTE SD_sync(void)
+;
+; Wait for the card to finish programming any write left in progress
+;
+; Returns: SD_SUCCESS, or SD_ERROR if the card is still busy
+
+		SCOPE
+
+_SD_sync:
+		LD		A,(sd_busy)
+		OR		A,A
+		RET		Z		; Not busy, return SD_SUCCESS
+
+		CALL		_SD_CS_enable	; Does the busy check
+		CALL		_SD_CS_disable
+
+		LD		A,(sd_busy)	; Still set if the check timed out
+		RET
+
+
+; NB: The following functions all jump to SD_readRegister
+;
+; _SD_readCSD
+; _SD_readCID
+; _SD_readSDStatus
+
+; BYTE SD_readCSD(BYTE *csd)
+;
+; Read the 16 byte CSD register
+;
+; Returns: SD_SUCCESS or SD_ERROR
+
+		SCOPE
+
+_SD_readCSD:
+		LD		BC,cmd9_string
+		LD		HL,16
+		XOR		A,A
+		JR		SD_readRegister
+
+
+; BYTE SD_readCID(BYTE *cid)
+;
+; Read the 16 byte CID register
+;
+; Returns: SD_SUCCESS or SD_ERROR
+
+_SD_readCID:
+		LD		BC,cmd10_string
+		LD		HL,16
+		XOR		A,A
+		JR		SD_readRegister
+
+
+; BYTE SD_readSDStatus(BYTE *sds)
+;
+; Read the 64 byte SD status with ACMD13
+;
+; Returns: SD_SUCCESS or SD_ERROR
+
+_SD_readSDStatus:
+		CALL		_SD_sendApp
+		CP		A,2
+		LD		A,SD_ERROR
+		RET		NC
+
+		LD		BC,acmd13_string
+		LD		HL,64
+		LD		A,1		; The response is R2, one byte longer than R1
+		; Fall through to SD_readRegister
+
+
+; SD_readRegister
+;
+; Send a command, then read the register it returns in a data block to the
+; buffer passed as the first argument of the caller
+;
+; Input:	BC := command string
+;		HL := length of the register
+;		A  := number of response bytes after R1
+;
+; Local variables:
+;	IX-6		response bytes left to skip
+;	IX-3..IX-1	length of the register
+;
+; Returns: SD_SUCCESS or SD_ERROR
+
+SD_readRegister:
+		; Function prologue on behalf of the function who jumped here
+		PUSH		IX
+		LD		IX,0
+		ADD		IX,SP
+		PUSH		HL
+		PUSH		HL
+		LD		(IX-6),A
+
+		LD		DE,SD_CMD_LEN
+		PUSH		DE
+		PUSH		BC
+
+		CALL		_SD_CS_enable
+
+		CALL		_spi_write
+		POP		BC
+		POP		BC
+
+		CALL		_SD_readRes1
+		OR		A,A
+		JR		NZ,$err_out
+
+		; Skip the rest of the response
+$skip:		LD		A,(IX-6)
+		OR		A,A
+		JR		Z,$token
+		DEC		(IX-6)
+		CALL		_spi_read_one
+		JR		$skip
+
+		; Wait for a start token (timeout = 100ms)
+$token:		TIMER_SET	0,100
+		TIMER_START	0
+
+$loop1:		CALL		_spi_read_one
+		LD		B,A		; Move byte read to B
+		CP		A,%FF
+		JR		NZ,$out1
+
+		; Continue until the timer expires
+		TIMER_EXP?	0		; (clobbers just A)
+		JR		NC,$loop1
+
+$out1:		TIMER_RESET	0		; (clobbers just A)
+
+		LD		A,SD_START_TOKEN
+		CP		A,B
+		JR		NZ,$err_out
+
+		; Read the register
+		LD		BC,(IX-3)
+		PUSH		BC
+		LD		BC,(IX+6)
+		PUSH		BC
+		CALL		_spi_read
+		POP		BC
+		POP		BC
+
+		; Read and discard the two CRC bytes
+		CALL		_spi_read_one
+		CALL		_spi_read_one
+
+		XOR		A,A		; LD A,SD_SUCCESS
+		JR		$out
+
+$err_out:	LD		A,SD_ERROR
+
+$out:		PUSH		AF
+		CALL		_SD_CS_disable
 		POP		AF
+
+		; Function epilogue
+		LD		SP,IX
+		POP		IX
+		RET
+
+
+; BYTE SD_erase(DWORD start, DWORD end)
+;		IX+6         IX+12
+;
+; Erase the blocks from start to end inclusive, and wait for the card to
+; finish (timeout = 10s)
+;
+; Local variables:
+;	IX-3/IX-2	Used by SD_sendIOCmd
+;	IX-1		token
+;
+; Returns: SD_SUCCESS or SD_ERROR
+
+		SCOPE
+
+_SD_erase:
+		; Function prologue
+		PUSH		IX
+		LD		IX,0
+		ADD		IX,SP
+		PUSH		BC	; 3 bytes for local variables
+
+		; Set the first block to erase
+		LD		(IX-3),CMD32     | %40
+		LD		(IX-2),CMD32_CRC | %01
+		CALL		SD_sendIOCmd
+		PUSH		AF
+		CALL		_SD_CS_disable
+		POP		AF
+		OR		A,A
+		JR		NZ,$err_out
+
+		; Set the last block to erase; SD_sendIOCmd takes it from IX+6
+		LD		HL,(IX+12)
+		LD		(IX+6),HL
+		LD		A,(IX+15)
+		LD		(IX+9),A
+		LD		(IX-3),CMD33     | %40
+		LD		(IX-2),CMD33_CRC | %01
+		CALL		SD_sendIOCmd
+		PUSH		AF
+		CALL		_SD_CS_disable
+		POP		AF
+		OR		A,A
+		JR		NZ,$err_out
+
+		; Erase; the argument must be zero
+		LD		HL,0
+		LD		(IX+6),HL
+		LD		(IX+9),L
+		LD		(IX-3),CMD38     | %40
+		LD		(IX-2),CMD38_CRC | %01
+		CALL		SD_sendIOCmd
+		OR		A,A
+		JR		NZ,$err_out
+
+		; Wait for the card to release busy, 40 x 250ms
+		LD		B,40
+$loop:		PUSH		BC
+		CALL		SD_waitReady
+		POP		BC
+		INC		A
+		JR		Z,$out
+		DJNZ		$loop
+
+$err_out:	LD		A,SD_ERROR
+
+$out:		PUSH		AF
+		CALL		_SD_CS_disable
+		POP		AF
+		LD		SP,IX
+		POP		IX
+		RET
+
+
+; SD_checkBusy
+;
+; Called with chip select asserted. If a write has been left in progress
+; then wait for the card to release busy, and clear the flag once it has
+;
+; Output: A := %FF if the card is ready
+
+		SCOPE
+
+SD_checkBusy:
+		LD		A,(sd_busy)
+		OR		A,A
+		LD		A,%FF
+		RET		Z
+
+		CALL		SD_waitReady
+		CP		A,%FF
+		RET		NZ
+
+		XOR		A,A
+		LD		(sd_busy),A
+		DEC		A
 		RET
 
 
@@ -457,6 +1043,7 @@ SD_sendIOCmd:
 		; buf[5] : = CRC
 		LD		B,(IX-2)
 		LD		(HL),B
+		CALL		SD_cmdBufferCRC
 
 		; Send contents of sd_cmd_buffer
 		CALL		_spi_write
@@ -467,6 +1054,211 @@ SD_sendIOCmd:
 		JP		_SD_readRes1
 
 
+; BYTE SD_setCRC(BYTE enable)
+;
+; Turn CRC checking of commands and data blocks on or off with CMD59. The
+; setting is kept, and sent again whenever the card is initialised
+;
+; Returns: SD_SUCCESS, or SD_ERROR if the card didn't accept it (CRC
+; checking is then left off)
+
+		SCOPE
+
+_SD_setCRC:
+		LD		HL,3
+		ADD		HL,SP
+		LD		A,(HL)
+		OR		A,A
+		JR		Z,$set
+		LD		A,1
+$set:		LD		(sd_crc),A
+		; Fall through to SD_sendCRCMode
+
+
+; SD_sendCRCMode
+;
+; Send CMD59 with sd_crc as its argument
+;
+; Output: A := SD_SUCCESS or SD_ERROR
+
+SD_sendCRCMode:
+		LD		HL,sd_cmd_buffer
+		LD		(HL),CMD59 | %40
+		INC		HL
+		LD		(HL),0
+		INC		HL
+		LD		(HL),0
+		INC		HL
+		LD		(HL),0
+		INC		HL
+		LD		A,(sd_crc)
+		LD		(HL),A
+
+		; Always needs a valid CRC, as CRC checking may be on already
+		LD		HL,sd_cmd_buffer
+		CALL		SD_crc7
+		LD		BC,sd_cmd_buffer
+		CALL		SD_sendCmdReadRes1
+		OR		A,A
+		RET		Z		; SD_SUCCESS
+
+		XOR		A,A
+		LD		(sd_crc),A
+		LD		A,SD_ERROR
+		RET
+
+
+; SD_cmdBufferCRC
+;
+; In CRC mode, set the CRC byte of the command in sd_cmd_buffer
+
+SD_cmdBufferCRC:
+		LD		A,(sd_crc)
+		OR		A,A
+		RET		Z
+		LD		HL,sd_cmd_buffer
+		; Fall through to SD_crc7
+
+
+; SD_crc7
+;
+; Calculate the CRC7 of a command. The CRC is kept left aligned in C so
+; that the polynomial (%09) is applied as %12
+;
+; Input:	HL := address of the first of the five command bytes
+; Output:	The sixth byte is set to the CRC and end bit
+
+SD_crc7:
+		LD		C,0
+		LD		D,5
+$byte:		LD		E,(HL)
+		INC		HL
+		LD		B,8
+$bit:		LD		A,E
+		XOR		A,C		; Bit 7 := data bit XOR CRC bit 6
+		SLA		E
+		SLA		C
+		RLA			; Carry := bit 7
+		JR		NC,$next
+		LD		A,C
+		XOR		A,%12
+		LD		C,A
+$next:		DJNZ		$bit
+		DEC		D
+		JR		NZ,$byte
+		LD		A,C
+		OR		A,%01
+		LD		(HL),A
+		RET
+
+
+; SD_readCRC
+;
+; This does not use the C calling-convention.
+; It uses the stack frame pointer and local space set up by _SD_readBlocks
+;
+; Read the two CRC bytes that follow a data block. In CRC mode, compare
+; them with the CRC of the block just read to buf, and set (IX-4) if they
+; don't match
+
+		SCOPE
+
+SD_readCRC:
+		CALL		_spi_read_one
+		PUSH		AF		; High byte first
+		CALL		_spi_read_one
+		LD		C,A
+		POP		AF
+		LD		B,A		; BC := CRC received
+
+		LD		A,(sd_crc)
+		OR		A,A
+		RET		Z
+
+		PUSH		BC
+		LD		HL,(IX+12)
+		CALL		SD_crc16
+		POP		BC
+		LD		A,B
+		CP		A,D
+		JR		NZ,$bad
+		LD		A,C
+		CP		A,E
+		RET		Z
+$bad:		LD		(IX-4),1
+		RET
+
+
+; SD_writeCRC
+;
+; This does not use the C calling-convention.
+; It uses the stack frame pointer set up by _SD_writeBlocks
+;
+; Send the two CRC bytes that follow a data block; the CRC of the block
+; at buf in CRC mode, otherwise dummy bytes
+
+		SCOPE
+
+SD_writeCRC:
+		LD		DE,%FFFF
+		LD		A,(sd_crc)
+		OR		A,A
+		JR		Z,$send
+		LD		HL,(IX+12)
+		CALL		SD_crc16
+
+$send:		PUSH		DE		; _spi_transfer clobbers DE
+		LD		C,D		; High byte first
+		PUSH		BC
+		CALL		_spi_transfer
+		POP		BC
+		POP		DE
+		LD		C,E
+		PUSH		BC
+		CALL		_spi_transfer
+		POP		BC
+		RET
+
+
+; SD_crc16
+;
+; Calculate the CRC16 (CCITT, as used by SD data blocks) of a 512 byte block
+; using the tables in crc16_table_hi and crc16_table_lo
+;
+; Input:	HL := address of the block
+; Output:	DE := CRC16
+; Clobbers:	A, BC, HL
+
+		SCOPE
+
+SD_crc16:
+		PUSH		IY
+		PUSH		HL
+		POP		IY
+		LD		HL,crc16_table_hi	; Aligned, so only L needs setting
+		LD		DE,0
+		LD		C,SD_BLOCK_LEN / 256
+		LD		B,0
+
+		; crc := (crc << 8) ^ table[(crc >> 8) ^ byte]
+$loop:		LD		A,(IY+0)
+		INC		IY
+		XOR		A,D
+		LD		L,A
+		LD		A,(HL)		; crc16_table_hi
+		XOR		A,E
+		LD		D,A
+		INC		H
+		LD		E,(HL)		; crc16_table_lo
+		DEC		H
+		DJNZ		$loop
+		DEC		C
+		JR		NZ,$loop
+
+		POP		IY
+		RET
+
+
 ; SD_updateIOVars
 ;
 ; This does not use the C calling-convention
@@ -682,7 +1474,8 @@ _SD_CS_enable:
 		IN0		A,(PB_DR)
 		RES		SD_CS,A
 		OUT0		(PB_DR),A
-		JP		_spi_read_one
+		CALL		_spi_read_one
+		JP		SD_checkBusy
 
 
 ; void SD_CS_disable();
@@ -726,6 +1519,27 @@ cmd8_string:	DB		CMD8 | %40
 		DB		CMD8_ARG       & %FF
 		DB		CMD8_CRC | %01
 
+cmd9_string:	DB		CMD9 | %40
+		DB		CMD9_ARG >> 24 & %FF
+		DB		CMD9_ARG >> 16 & %FF
+		DB		CMD9_ARG >>  8 & %FF
+		DB		CMD9_ARG       & %FF
+		DB		CMD9_CRC | %01
+
+cmd10_string:	DB		CMD10 | %40
+		DB		CMD10_ARG >> 24 & %FF
+		DB		CMD10_ARG >> 16 & %FF
+		DB		CMD10_ARG >>  8 & %FF
+		DB		CMD10_ARG       & %FF
+		DB		CMD10_CRC | %01
+
+cmd12_string:	DB		CMD12 | %40
+		DB		CMD12_ARG >> 24 & %FF
+		DB		CMD12_ARG >> 16 & %FF
+		DB		CMD12_ARG >>  8 & %FF
+		DB		CMD12_ARG       & %FF
+		DB		CMD12_CRC | %01
+
 cmd55_string:	DB		CMD55 | %40
 		DB		CMD55_ARG >> 24 & %FF
 		DB		CMD55_ARG >> 16 & %FF
@@ -740,6 +1554,13 @@ acmd41_string:	DB		ACMD41 | %40
 		DB		ACMD41_ARG       & %FF
 		DB		ACMD41_CRC | %01
 
+acmd13_string:	DB		ACMD13 | %40
+		DB		ACMD13_ARG >> 24 & %FF
+		DB		ACMD13_ARG >> 16 & %FF
+		DB		ACMD13_ARG >>  8 & %FF
+		DB		ACMD13_ARG       & %FF
+		DB		ACMD13_CRC | %01
+
 cmd58_string:	DB		CMD58 | %40
 		DB		CMD58_ARG >> 24 & %FF
 		DB		CMD58_ARG >> 16 & %FF
@@ -747,5 +1568,81 @@ cmd58_string:	DB		CMD58 | %40
 		DB		CMD58_ARG       & %FF
 		DB		CMD58_CRC | %01
 
+		; CRC16 lookup tables, high then low bytes of each entry. Aligned to
+		; 512 bytes so that the low byte table is in the next 256 byte page
+
+		DEFINE		SD_CRC16, SPACE = ROM, ALIGN = 200h
+		SEGMENT		SD_CRC16
+
+crc16_table_hi:
+		DB		%00, %10, %20, %30, %40, %50, %60, %70
+		DB		%81, %91, %A1, %B1, %C1, %D1, %E1, %F1
+		DB		%12, %02, %32, %22, %52, %42, %72, %62
+		DB		%93, %83, %B3, %A3, %D3, %C3, %F3, %E3
+		DB		%24, %34, %04, %14, %64, %74, %44, %54
+		DB		%A5, %B5, %85, %95, %E5, %F5, %C5, %D5
+		DB		%36, %26, %16, %06, %76, %66, %56, %46
+		DB		%B7, %A7, %97, %87, %F7, %E7, %D7, %C7
+		DB		%48, %58, %68, %78, %08, %18, %28, %38
+		DB		%C9, %D9, %E9, %F9, %89, %99, %A9, %B9
+		DB		%5A, %4A, %7A, %6A, %1A, %0A, %3A, %2A
+		DB		%DB, %CB, %FB, %EB, %9B, %8B, %BB, %AB
+		DB		%6C, %7C, %4C, %5C, %2C, %3C, %0C, %1C
+		DB		%ED, %FD, %CD, %DD, %AD, %BD, %8D, %9D
+		DB		%7E, %6E, %5E, %4E, %3E, %2E, %1E, %0E
+		DB		%FF, %EF, %DF, %CF, %BF, %AF, %9F, %8F
+		DB		%91, %81, %B1, %A1, %D1, %C1, %F1, %E1
+		DB		%10, %00, %30, %20, %50, %40, %70, %60
+		DB		%83, %93, %A3, %B3, %C3, %D3, %E3, %F3
+		DB		%02, %12, %22, %32, %42, %52, %62, %72
+		DB		%B5, %A5, %95, %85, %F5, %E5, %D5, %C5
+		DB		%34, %24, %14, %04, %74, %64, %54, %44
+		DB		%A7, %B7, %87, %97, %E7, %F7, %C7, %D7
+		DB		%26, %36, %06, %16, %66, %76, %46, %56
+		DB		%D9, %C9, %F9, %E9, %99, %89, %B9, %A9
+		DB		%58, %48, %78, %68, %18, %08, %38, %28
+		DB		%CB, %DB, %EB, %FB, %8B, %9B, %AB, %BB
+		DB		%4A, %5A, %6A, %7A, %0A, %1A, %2A, %3A
+		DB		%FD, %ED, %DD, %CD, %BD, %AD, %9D, %8D
+		DB		%7C, %6C, %5C, %4C, %3C, %2C, %1C, %0C
+		DB		%EF, %FF, %CF, %DF, %AF, %BF, %8F, %9F
+		DB		%6E, %7E, %4E, %5E, %2E, %3E, %0E, %1E
+
+crc16_table_lo:
+		DB		%00, %21, %42, %63, %84, %A5, %C6, %E7
+		DB		%08, %29, %4A, %6B, %8C, %AD, %CE, %EF
+		DB		%31, %10, %73, %52, %B5, %94, %F7, %D6
+		DB		%39, %18, %7B, %5A, %BD, %9C, %FF, %DE
+		DB		%62, %43, %20, %01, %E6, %C7, %A4, %85
+		DB		%6A, %4B, %28, %09, %EE, %CF, %AC, %8D
+		DB		%53, %72, %11, %30, %D7, %F6, %95, %B4
+		DB		%5B, %7A, %19, %38, %DF, %FE, %9D, %BC
+		DB		%C4, %E5, %86, %A7, %40, %61, %02, %23
+		DB		%CC, %ED, %8E, %AF, %48, %69, %0A, %2B
+		DB		%F5, %D4, %B7, %96, %71, %50, %33, %12
+		DB		%FD, %DC, %BF, %9E, %79, %58, %3B, %1A
+		DB		%A6, %87, %E4, %C5, %22, %03, %60, %41
+		DB		%AE, %8F, %EC, %CD, %2A, %0B, %68, %49
+		DB		%97, %B6, %D5, %F4, %13, %32, %51, %70
+		DB		%9F, %BE, %DD, %FC, %1B, %3A, %59, %78
+		DB		%88, %A9, %CA, %EB, %0C, %2D, %4E, %6F
+		DB		%80, %A1, %C2, %E3, %04, %25, %46, %67
+		DB		%B9, %98, %FB, %DA, %3D, %1C, %7F, %5E
+		DB		%B1, %90, %F3, %D2, %35, %14, %77, %56
+		DB		%EA, %CB, %A8, %89, %6E, %4F, %2C, %0D
+		DB		%E2, %C3, %A0, %81, %66, %47, %24, %05
+		DB		%DB, %FA, %99, %B8, %5F, %7E, %1D, %3C
+		DB		%D3, %F2, %91, %B0, %57, %76, %15, %34
+		DB		%4C, %6D, %0E, %2F, %C8, %E9, %8A, %AB
+		DB		%44, %65, %06, %27, %C0, %E1, %82, %A3
+		DB		%7D, %5C, %3F, %1E, %F9, %D8, %BB, %9A
+		DB		%75, %54, %37, %16, %F1, %D0, %B3, %92
+		DB		%2E, %0F, %6C, %4D, %AA, %8B, %E8, %C9
+		DB		%26, %07, %64, %45, %A2, %83, %E0, %C1
+		DB		%1F, %3E, %5D, %7C, %9B, %BA, %D9, %F8
+		DB		%17, %36, %55, %74, %93, %B2, %D1, %F0
+
 		SECTION		BSS
 sd_cmd_buffer:	DS		6
+sd_crc:		DS		1		; Non-zero if CRC checking is on
+sd_busy:	DS		1		; Non-zero if a write may still be in progress
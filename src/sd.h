@@ -3,10 +3,12 @@
  * Author:			RJH
  * Modified By:		Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	08/11/2023
+ * Last Updated:	16/10/2026
  *
  * Modinfo:
  * 08/11/2023:		Removed redundant defines and function prototypes
+ * 16/10/2026:		Added SD_sync, SD_readCSD, SD_erase, SD_setCRC
+ *				Added SD_readCID, SD_readOCR, SD_readSDStatus
  */
 
 #ifndef SD_H
@@ -18,6 +20,13 @@
 
 BYTE	SD_readBlocks(DWORD addr, BYTE *buf, WORD count);
 BYTE	SD_writeBlocks(DWORD addr, BYTE *buf, WORD count);
+BYTE	SD_sync();
+BYTE	SD_readCSD(BYTE *csd);
+BYTE	SD_readCID(BYTE *cid);
+BYTE	SD_readSDStatus(BYTE *sds);
+void	SD_readOCR(BYTE *res);
+BYTE	SD_erase(DWORD start, DWORD end);
+BYTE	SD_setCRC(BYTE enable);
 
 BYTE	SD_init();
 
@@ -2,7 +2,7 @@
 ; Title:	AGON MOS - UART code
 ; Author:	Dean Belfield
 ; Created:	11/07/2022
-; Last Updated:	29/03/2023
+; Last Updated:	16/10/2026
 ;
 ; Modinfo:
 ; 27/07/2022:	Reverted serial_TX back to use RET, not RET.L and increased timeout
@@ -10,6 +10,10 @@
 ; 22/03/2023:	Added serial_PUTCH, moved putch and getch from uart.c
 ; 23/03/2023:	Renamed serial_RX_WAIT to seral_GETCH
 ; 29/03/2023:	Added support for UART1
+; 16/10/2026:	Added UART0_writeBlock
+;		UART0 output is buffered and sent from the transmit interrupt; added UART0_serial_FLUSH
+;		Added UART0_serial_WRITE
+;		Output is passed to vdp_protocol_snoop to keep the shadow VDP state honest
 
 			INCLUDE	"macros.inc"
 			INCLUDE	"equs.inc"
@@ -23,6 +27,9 @@
 			XDEF	UART0_serial_RX
 			XDEF	UART0_serial_GETCH
 			XDEF	UART0_serial_PUTCH 
+			XDEF	UART0_serial_TXFILL
+			XDEF	UART0_serial_FLUSH
+			XDEF	UART0_serial_WRITE
 
 			XDEF	UART1_serial_TX
 			XDEF	UART1_serial_RX
@@ -31,11 +38,19 @@
 
 			XDEF	_putch
 			XDEF	_getch 
+			XDEF	_UART0_writeBlock
+			XDEF	_UART0_flush
 			
 			XDEF	putch 		
 			XDEF	getch 
 
 			XREF	_serialFlags	; In globals.asm
+			XREF	_uart0_txbuf
+			XREF	_uart0_txhead
+			XREF	_uart0_txtail
+			XREF	_vdp_shadow
+			XREF	_vdp_txcount
+			XREF	vdp_protocol_snoop	; In vdp_protocol.asm
 				
 UART0_PORT		EQU	%C0		; UART0
 UART1_PORT		EQU	%D0		; UART1
@@ -73,6 +88,10 @@ UART_LSR_ETX		EQU 	%40		; Transmit empty
 UART_LSR_ETH		EQU	%20		; Transmit holding register empty
 UART_LSR_RDY		EQU	%01		; Data ready
 
+UART_IER_TIE		EQU	%02		; Transmit interrupt enable
+
+UART_FIFO_SIZE		EQU	16		; Size of the transmit FIFO
+
 ; Check whether we're clear to send (UART0 only)
 ;
 UART0_wait_CTS:		GET_GPIO	PD_DR, 8		; Check Port D, bit 3 (CTS)
@@ -200,10 +219,13 @@ $$:			CALL 		UART1_serial_RX
 ; - F: C if written
 ; - F: NC if UART not enabled
 ;
-UART0_serial_PUTCH:	PUSH	AF
+UART0_serial_PUTCH:	CALL	vdp_protocol_snoop		; Forget any shadow VDP state this may change
+			PUSH	AF
 			LD	A, (_serialFlags)		; Get the serial flags
 			TST	01h				; Check UART is enabled
 			JR	Z, UART_serial_NE		; If not, then skip
+			TST	04h				; If the transmit buffer is enabled then
+			JR	NZ, UART0_serial_PUTB		; Add the character to that
 			TST	02h				; If hardware flow control enabled then
 			CALL	NZ, UART0_wait_CTS		; Wait for clear to send signal
 			POP	AF
@@ -211,6 +233,249 @@ $$:			CALL	UART0_serial_TX			; Send the character
 			JR	NC, $B				; Repeat until sent
 			RET
 
+; Add a character to the UART0 transmit buffer (blocking)
+; Parameters:
+; - A: Character to write out (stacked by UART0_serial_PUTCH)
+; Returns:
+; - F: C
+;
+UART0_serial_PUTB:	POP	AF
+			PUSH	BC
+			PUSH	DE
+			PUSH	HL
+			LD	B, A				; B: Character to write out
+			LD	A, I				; Sets parity bit to value of IEF2
+			PUSH	AF
+			DI					; Disable interrupts while the buffer is updated
+			LD	DE, 0
+$$:			LD	A, (_uart0_txhead)
+			LD	E, A				; DE: Head index
+			INC	A
+			LD	C, A				; C: Next head index (wraps at 256)
+			LD	A, (_uart0_txtail)		; Is the buffer full?
+			CP	C
+			JR	NZ, UART0_serial_PUTB1		; No, so add the character
+			PUSH	BC
+			CALL	UART0_serial_TXFILL		; Otherwise move what we can into the FIFO
+			POP	BC
+			POP	AF
+			PUSH	AF
+			JP	PO, $B				; If interrupts were enabled then
+			EI					; Let any pending ones in before trying again
+			NOP
+			DI
+			JR	$B
+;
+UART0_serial_PUTB1:	LD	HL, _uart0_txbuf
+			ADD	HL, DE
+			LD	(HL), B				; Store the character
+			LD	A, C
+			LD	(_uart0_txhead), A		; Advance the head
+			PUSH	BC
+			CALL	UART0_serial_TXFILL		; And start sending if the FIFO is empty
+			POP	BC
+			POP	AF
+			JP	PO, $F				; Parity bit is IEF2
+			EI
+$$:			LD	A, B				; A: The character written
+			POP	HL
+			POP	DE
+			POP	BC
+			SCF
+			RET
+
+; Move data from the UART0 transmit buffer into the transmit FIFO
+; This must be called with interrupts disabled. It is called by the UART0 and
+; VBLANK interrupt handlers, and whenever a character is added to the buffer
+; The transmit interrupt is left enabled only while the FIFO is still sending
+; and there is more data waiting; if the VDP is not clear to send then it is
+; disabled, and the next VBLANK or write tries again
+; Corrupts:
+; - AF, BC, DE, HL
+;
+UART0_serial_TXFILL:	LD	A, (_serialFlags)		; Get the serial flags
+			TST	04h				; Is the transmit buffer enabled?
+			RET	Z				; No, so nothing to do
+			LD	DE, 0
+			LD	HL, _uart0_txtail
+			LD	E, (HL)				; DE: Tail index
+			LD	A, (_uart0_txhead)		; Is the buffer empty?
+			CP	E
+			JR	Z, UART0_serial_TXOFF		; Yes, so the transmit interrupt is not needed
+			IN0	A, (UART0_REG_LSR)		; Is the transmit FIFO empty?
+			AND	UART_LSR_ETH
+			JR	Z, UART0_serial_TXON		; No, so wait for the transmit interrupt
+			LD	A, (_serialFlags)		; If hardware flow control enabled then
+			TST	02h
+			JR	Z, $F
+			GET_GPIO	PD_DR, 8		; Check whether we're clear to send
+			JR	NZ, UART0_serial_TXOFF		; If not, then try again later
+$$:			LD	B, UART_FIFO_SIZE		; B: Maximum number of bytes to write
+$$:			LD	HL, _uart0_txbuf
+			ADD	HL, DE
+			LD	A, (HL)				; Write the next byte into the FIFO
+			OUT0	(UART0_REG_THR), A
+			INC	E				; Advance the tail (wraps at 256)
+			LD	A, (_uart0_txhead)		; Is the buffer now empty?
+			CP	E
+			JR	Z, $F				; Yes, so stop
+			DJNZ	$B				; Loop until the FIFO is full
+$$:			LD	A, E				; Store the tail (does not affect the flags)
+			LD	(_uart0_txtail), A
+			JR	Z, UART0_serial_TXOFF		; If the buffer is empty, then disable the interrupt
+;
+UART0_serial_TXON:	IN0	A, (UART0_REG_IER)		; Enable the transmit interrupt
+			OR	UART_IER_TIE
+			OUT0	(UART0_REG_IER), A
+			RET
+;
+UART0_serial_TXOFF:	IN0	A, (UART0_REG_IER)		; Disable the transmit interrupt
+			AND	%FF - UART_IER_TIE
+			OUT0	(UART0_REG_IER), A
+			RET
+
+; Write a block of data to UART0 (blocking)
+; Without the transmit buffer, this waits for the transmit FIFO to empty and
+; fills it in bursts, checking CTS once per burst rather than once per byte
+; Parameters:
+; - HL: Pointer to the data
+; - BC: Number of bytes to write (16-bit)
+; Returns:
+; - HL: Pointer to the byte after the data
+; - BC: 0
+; -  A: 0
+; -  F: NC if UART not enabled
+;
+UART0_serial_WRITE:	LD	A, B				; Is there anything to write?
+			OR	C
+			RET	Z
+			XOR	A, A				; The block could contain anything, so
+			LD	(_vdp_shadow), A		; Forget all the shadow VDP state
+			LD	A, (_vdp_txcount)		; And count it as sent
+			INC	A
+			LD	(_vdp_txcount), A
+			LD	A, (_serialFlags)		; Get the serial flags
+			TST	01h				; Check UART is enabled
+			RET	Z				; If not, then skip (TST clears the carry)
+			PUSH	DE
+			TST	04h				; If the transmit buffer is enabled then
+			JR	NZ, UART0_serial_WRITEB		; Add the data to that
+;
+UART0_serial_WRITE1:	LD	A, (_serialFlags)		; Get the serial flags
+			TST	02h				; If hardware flow control enabled then
+			CALL	NZ, UART0_wait_CTS		; Wait for clear to send signal
+$$:			IN0	A, (UART0_REG_LSR)		; Wait for the transmit FIFO to empty
+			AND	UART_LSR_ETH
+			JR	Z, $B
+			LD	E, UART_FIFO_SIZE		; E: Number of bytes to write in this burst
+$$:			LD	A, (HL)				; Write the next byte into the FIFO
+			OUT0	(UART0_REG_THR), A
+			INC	HL
+			DEC	BC
+			LD	A, B				; Is that everything?
+			OR	C
+			JR	Z, UART0_serial_WRITE2		; Yes, so we're done
+			DEC	E
+			JR	NZ, $B				; Loop until the FIFO is full
+			JR	UART0_serial_WRITE1		; And start the next burst
+;
+UART0_serial_WRITE2:	POP	DE
+			SCF
+			RET
+
+; Copy a block of data into the UART0 transmit buffer (blocking)
+; Interrupts are let in every 16 bytes, so receive is not starved
+; Parameters:
+; - HL: Pointer to the data
+; - BC: Number of bytes to write (not zero)
+; - DE: Stacked by UART0_serial_WRITE
+;
+UART0_serial_WRITEB:	PUSH	IX
+			LD	A, I				; Sets parity bit to value of IEF2
+			PUSH	AF
+			DI					; Disable interrupts while the buffer is updated
+			LD	DE, 0
+UART0_serial_WRITEB1:	LD	A, (_uart0_txhead)
+			LD	E, A				; DE: Head index
+$$:			LD	A, (_uart0_txtail)		; Is the buffer full?
+			DEC	A
+			CP	E
+			JR	Z, UART0_serial_WRITEB2		; Yes, so send some of it first
+			LD	IX, _uart0_txbuf
+			ADD	IX, DE
+			LD	A, (HL)				; Copy the next byte into the buffer
+			LD	(IX+0), A
+			INC	HL
+			INC	E				; Advance the head (wraps at 256)
+			DEC	BC
+			LD	A, B				; Is that everything?
+			OR	C
+			JR	Z, UART0_serial_WRITEB3
+			LD	A, E				; Every 16 bytes, update the head
+			AND	UART_FIFO_SIZE - 1
+			JR	NZ, $B
+;
+UART0_serial_WRITEB2:	LD	A, E
+			LD	(_uart0_txhead), A		; Update the head
+			PUSH	BC
+			PUSH	HL
+			CALL	UART0_serial_TXFILL		; Move what we can into the FIFO
+			POP	HL
+			POP	BC
+			LD	DE, 0
+			POP	AF
+			PUSH	AF
+			JP	PO, UART0_serial_WRITEB1	; If interrupts were enabled then
+			EI					; Let any pending ones in before carrying on
+			NOP
+			DI
+			JR	UART0_serial_WRITEB1
+;
+UART0_serial_WRITEB3:	LD	A, E
+			LD	(_uart0_txhead), A		; Update the head
+			PUSH	HL
+			CALL	UART0_serial_TXFILL		; And start sending if the FIFO is empty
+			POP	HL
+			LD	BC, 0
+			POP	AF
+			JP	PO, $F				; Parity bit is IEF2
+			EI
+$$:			POP	IX
+			POP	DE
+			XOR	A, A
+			SCF
+			RET
+
+; Wait until all the data in the UART0 transmit buffer has been sent
+; Used where output must have reached the VDP before waiting on a reply
+;
+UART0_serial_FLUSH:	PUSH	AF
+			PUSH	BC
+			PUSH	DE
+			PUSH	HL
+UART0_serial_FLUSH1:	LD	A, I				; Sets parity bit to value of IEF2
+			PUSH	AF
+			DI
+			CALL	UART0_serial_TXFILL		; Move what we can into the FIFO
+			POP	AF
+			JP	PO, $F				; Parity bit is IEF2
+			EI
+$$:			LD	A, (_uart0_txhead)		; Loop until the buffer is empty
+			LD	HL, _uart0_txtail
+			CP	(HL)
+			JR	NZ, UART0_serial_FLUSH1
+			LD	A, (_serialFlags)		; If the UART is enabled then
+			TST	01h
+			JR	Z, UART0_serial_FLUSH3
+UART0_serial_FLUSH2:	IN0	A, (UART0_REG_LSR)		; Wait for the transmitter to empty
+			AND	UART_LSR_ETX
+			JR	Z, UART0_serial_FLUSH2
+UART0_serial_FLUSH3:	POP	HL
+			POP	DE
+			POP	BC
+			POP	AF
+			RET
+
 ; Write a character to UART1 (blocking)
 ; Parameters:
 ; - A: Character to write out
@@ -277,4 +542,41 @@ getch:			PUSH	IY				; Standard C prologue
 
 			LD 	SP, IY				; Standard epilogue
 			POP	IY
-			RET
\ No newline at end of file
+			RET
+
+; UINT UART0_writeBlock(const BYTE * buf, UINT len);
+;
+; Write a block of data out to UART0
+; The signature matches the streaming function that FatFS f_forward expects
+; Parameters:
+; - buf: Pointer to the data to write
+; - len: Number of bytes to write, up to 65535 (0 to check whether the UART is ready)
+; Returns:
+; - Number of bytes written; if len is 0 then 1 if ready, otherwise 0
+;
+_UART0_writeBlock:	PUSH	IY				; Standard C prologue
+			LD	IY, 0
+			ADD	IY, SP
+
+			LD	HL, 0				; HLU: The return value
+			LD	A, (_serialFlags)		; Get the serial flags
+			TST	01h				; Check UART is enabled
+			JR	Z, UART0_writeBlock_X		; If not, then nothing is written
+			LD	BC, (IY+9)			; BC: Number of bytes to write
+			OR	A, A
+			SBC	HL, BC				; Is it zero?
+			LD	HL, 1				; If so, then the UART is ready
+			JR	Z, UART0_writeBlock_X
+			LD	HL, (IY+6)			; HL: Pointer to the data
+			CALL	UART0_serial_WRITE		; Write it out
+			LD	HL, (IY+9)			; HLU: The return value
+
+UART0_writeBlock_X:	LD 	SP, IY				; Standard epilogue
+			POP	IY
+			RET
+
+; void UART0_flush(void);
+;
+; Wait until all the data in the UART0 transmit buffer has been sent
+;
+_UART0_flush:		JP	UART0_serial_FLUSH
\ No newline at end of file
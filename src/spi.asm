@@ -2,10 +2,11 @@
 ; Title:	AGON MOS - SPI low level assembly language
 ; Author:	Leigh Brown
 ; Created:	26/05/2023
-; Last Updated:	26/05/2023
+; Last Updated:	16/10/2026
 
 ; Modinfo
-;
+; 16/10/2026:	Start at the card identification clock rate, added spi_setDivisor
+;		Added spi_readBlock and spi_writeBlock
 
 ; The approach taken to maximise performance is:
 ; 1) Minimise the time between receiving the response from the current request
@@ -17,6 +18,12 @@
 
 SPI_ENA_DELAY	.equ	50
 
+SPI_DIVISOR_INIT	.equ	24	; 384KHz, card identification must be 400KHz or less
+
+SPI_POLL_LIMIT	.equ	255	; Polls of SPI_SR before giving up on a byte; each
+				; poll is about 12 cycles, a byte at the slowest
+				; divisor is 384
+
 SD_CS		.equ	4	; Bit 4
 
 SPI_MOSI	.equ	7	; PB7
@@ -24,10 +31,13 @@ SPI_MISO	.equ	6	; PB6
 SPI_CLK		.equ	3	; PB3
 
 		XDEF	_init_spi
+		XDEF	_spi_setDivisor
 		XDEF	_spi_transfer
 		XDEF	_spi_read_one
 		XDEF	_spi_read
 		XDEF	_spi_write
+		XDEF	spi_readBlock
+		XDEF	spi_writeBlock
 
 		.ASSUME ADL = 1
 
@@ -106,10 +116,11 @@ _init_spi:	;
 		OUT0		(SPI_CTL),A
 	
 		;
-		; Set SPI baud rate generator divisor registers
+		; Set SPI baud rate generator divisor registers; disk_initialize
+		; speeds this up once the card has been identified
 		;
 
-		LD		BC,3		; I changed from 4 to 3
+		LD		BC,SPI_DIVISOR_INIT
 		OUT0		(SPI_BRG_H),B
 		OUT0		(SPI_BRG_L),C
 
@@ -129,6 +140,31 @@ _init_spi:	;
 		RET
 
 
+; void spi_setDivisor(UINT16 divisor);
+;
+; Set the SPI baud rate generator divisor: SCK = MASTERCLOCK / (2 * divisor)
+
+		SCOPE
+
+_spi_setDivisor:
+		LD		HL,3
+		ADD		HL,SP
+		LD		C,(HL)		; C := low byte of divisor
+		INC		HL
+		LD		B,(HL)		; B := high byte of divisor
+
+		; Disable SPI whilst the divisor is changed
+		XOR		A,A
+		OUT0		(SPI_CTL),A
+		OUT0		(SPI_BRG_H),B
+		OUT0		(SPI_BRG_L),C
+
+		; Enable SPI as master
+		LD		A,%30
+		OUT0		(SPI_CTL),A
+		RET
+
+
 ; unsigned char spi_read_one(void);
 ;
 		SCOPE
@@ -277,3 +313,205 @@ $looplast:	IN0		A,(SPI_SR)
 $sentlast:	; Don't bother reading the dummy byte (IN0 A,(SPI_RBR))
 		RET
 
+
+; spi_readBlock
+;
+; Read a 512 byte block. A fixed length version of spi_read for the SD card
+; data path: the loop is unrolled four times, the count is an 8-bit DJNZ,
+; and each wait for the SPI is limited to SPI_POLL_LIMIT polls.
+;
+; Cycles per byte outside the status poll, with no wait states: 13 on average
+; (12, plus 4 for the DJNZ every fourth byte), against 27 for spi_read. The
+; poll costs 8 when the byte is ready and 11 for each extra pass in both.
+;
+; This does not use the C calling-convention.
+;
+; Input:	HL := buffer
+; Output:	Carry set if the SPI timed out
+; Clobbers:	A, BC, DE, HL
+
+		SCOPE
+
+spi_readBlock:
+		LD		D,%FF		; Dummy byte to clock out
+		OUT0		(SPI_TSR),D	; Request the first byte
+		LD		C,SPI_POLL_LIMIT
+		LD		E,C
+		LD		B,(512 - 4) / 4
+
+		; Each byte is read, then the next requested, before it is stored
+$loop4:
+$p1:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$g1
+		DEC		E
+		JR		NZ,$p1
+		JP		$timeout
+$g1:		IN0		A,(SPI_RBR)
+		OUT0		(SPI_TSR),D
+		LD		(HL),A
+		INC		HL
+		LD		E,C
+$p2:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$g2
+		DEC		E
+		JR		NZ,$p2
+		JP		$timeout
+$g2:		IN0		A,(SPI_RBR)
+		OUT0		(SPI_TSR),D
+		LD		(HL),A
+		INC		HL
+		LD		E,C
+$p3:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$g3
+		DEC		E
+		JR		NZ,$p3
+		JP		$timeout
+$g3:		IN0		A,(SPI_RBR)
+		OUT0		(SPI_TSR),D
+		LD		(HL),A
+		INC		HL
+		LD		E,C
+$p4:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$g4
+		DEC		E
+		JR		NZ,$p4
+		JP		$timeout
+$g4:		IN0		A,(SPI_RBR)
+		OUT0		(SPI_TSR),D
+		LD		(HL),A
+		INC		HL
+		LD		E,C
+		DJNZ		$loop4
+
+		; The last four bytes; request all but the last
+		LD		B,3
+$loop1:
+$p5:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$g5
+		DEC		E
+		JR		NZ,$p5
+		JP		$timeout
+$g5:		IN0		A,(SPI_RBR)
+		OUT0		(SPI_TSR),D
+		LD		(HL),A
+		INC		HL
+		LD		E,C
+		DJNZ		$loop1
+
+$p6:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$g6
+		DEC		E
+		JR		NZ,$p6
+		JP		$timeout
+$g6:		IN0		A,(SPI_RBR)
+		LD		(HL),A
+		INC		HL
+		LD		E,C
+		OR		A,A		; Clear carry
+		RET
+
+$timeout:	SCF
+		RET
+
+
+; spi_writeBlock
+;
+; Write a 512 byte block. A fixed length version of spi_write for the SD
+; card data path, unrolled in the same way as spi_readBlock.
+;
+; Cycles per byte outside the status poll, with no wait states: 9 on average
+; (8, plus 4 for the DJNZ every fourth byte), against 22 for spi_write.
+;
+; This does not use the C calling-convention.
+;
+; Input:	HL := buffer
+; Output:	Carry set if the SPI timed out
+; Clobbers:	A, BC, DE, HL
+
+		SCOPE
+
+spi_writeBlock:
+		LD		A,(HL)		; Write the first byte as soon as we can
+		OUT0		(SPI_TSR),A
+		INC		HL
+		LD		C,SPI_POLL_LIMIT
+		LD		E,C
+		LD		B,(512 - 4) / 4
+
+		; Each byte is loaded whilst the previous one is being sent
+$loop4:
+		LD		D,(HL)
+		INC		HL
+$p1:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$s1
+		DEC		E
+		JR		NZ,$p1
+		JP		$timeout
+$s1:		OUT0		(SPI_TSR),D
+		LD		E,C
+		LD		D,(HL)
+		INC		HL
+$p2:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$s2
+		DEC		E
+		JR		NZ,$p2
+		JP		$timeout
+$s2:		OUT0		(SPI_TSR),D
+		LD		E,C
+		LD		D,(HL)
+		INC		HL
+$p3:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$s3
+		DEC		E
+		JR		NZ,$p3
+		JP		$timeout
+$s3:		OUT0		(SPI_TSR),D
+		LD		E,C
+		LD		D,(HL)
+		INC		HL
+$p4:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$s4
+		DEC		E
+		JR		NZ,$p4
+		JP		$timeout
+$s4:		OUT0		(SPI_TSR),D
+		LD		E,C
+		DJNZ		$loop4
+
+		; The last three bytes
+		LD		B,3
+$loop1:
+		LD		D,(HL)
+		INC		HL
+$p5:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$s5
+		DEC		E
+		JR		NZ,$p5
+		JP		$timeout
+$s5:		OUT0		(SPI_TSR),D
+		LD		E,C
+		DJNZ		$loop1
+
+		; Wait for the last byte to go
+$p6:		IN0		A,(SPI_SR)
+		RLA
+		JR		C,$done
+		DEC		E
+		JR		NZ,$p6
+
+$timeout:	SCF
+		RET
+
+$done:		OR		A,A		; Clear carry
+		RET
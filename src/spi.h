@@ -3,16 +3,21 @@
  * Author:			Cocoacrumbs
  * Modified by:		Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	11/07/2022
+ * Last Updated:	16/10/2026
  *
  * Modinfo:
  * 11/07/2022:		Now includes defines.h; init_hw renamed to init_spi
+ * 16/10/2026:		Added spi_setDivisor
  */
 
 #ifndef SPI_H
 #define SPI_H
 
+#define SPI_DIVISOR_INIT	24		// 384KHz, card identification must be 400KHz or less
+#define SPI_DIVISOR_MIN		2		// 4.608MHz, the fastest the eZ80 SPI master can run
+
 void init_spi();
+void spi_setDivisor(UINT16 divisor);
 
 BYTE spi_transfer(BYTE d);
 BYTE spi_read_one(void);
@@ -2,7 +2,7 @@
  * Title:			AGON MOS - Timer
  * Author:			Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	03/08/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 11/07/2022:		Removed unused functions
@@ -11,12 +11,18 @@
  * 31/03/2023:		Added wait_VDP
  * 08/04/2023:		Fixed timing loop in wait_VDP
  * 03/08/2023:		Fixed timer0 setup overflow in init_timer0
+ * 16/10/2026:		wait_VDP flushes the UART0 transmit buffer before waiting
+ *					wait_VDP times out against the VBLANK clock; added wait_VDPreply
  */
 
 #include <eZ80.h>
 #include <defines.h>
 
+#include "config.h"
 #include "timer.h"
+#include "uart.h"
+
+extern volatile UINT32 clock;					// In globals.asm
 
 // Configure Timer 0
 // Parameters:
@@ -71,6 +77,13 @@ unsigned short get_timer0() {
 	return (h << 8) | l;
 }
 
+// Read the bottom 24 bits of the centisecond clock
+// This is a single load, so the VBLANK handler cannot update it halfway through
+//
+static UINT24 clock24() {
+	return *(volatile UINT24 *)&clock;
+}
+
 // Wait for the VDP packet to come in, with a timeout
 // Parameters:
 // - mask: Mask for the packet(s) we're expecting
@@ -78,14 +91,36 @@ unsigned short get_timer0() {
 // - True if the packet is received, False if there is a timeout
 //
 BOOL wait_VDP(unsigned char mask) {
-	int		i;
-	BOOL	retVal = 0;
+	UINT24	start;
+
+	UART0_flush();								// Make sure the request has been sent
+	start = clock24();
+	while((vpd_protocol_flags & mask) == 0) {	// Until we get a result
+		if(clock24() - start > MOS_vdpTimeout) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Wait for the reply to a VDP request, with a timeout
+// Read the reply's sequence counter before sending the request, then pass it in here;
+// this returns when the counter moves on, so an earlier reply cannot satisfy the wait
+// Parameters:
+// - seq: Index of the reply's sequence counter (VDPP_SEQ_CURSOR, etc)
+// - count: The value of the counter before the request was sent
+// Returns:
+// - True if the reply is received, False if there is a timeout
+//
+BOOL wait_VDPreply(BYTE seq, BYTE count) {
+	UINT24	start;
 
-	for(i = 0; i < 250000; i++) {				// A small delay loop (~1s)
-		if(vpd_protocol_flags & mask) {			// If we get a result then
-			retVal = 1;							// Set the return value to true
-			break;								// And exit the loop
+	UART0_flush();								// Make sure the request has been sent
+	start = clock24();
+	while(vdp_protocol_seq[seq] == count) {		// Until the reply comes in
+		if(clock24() - start > MOS_vdpTimeout) {
+			return 0;
 		}
 	}
-	return retVal;
+	return 1;
 }
@@ -3,12 +3,13 @@
  * Author:			Cocoacrumbs
  * Modified by:		Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	31/03/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 11/07/2022:		Removed unused functions
  * 13/03/2023:      Refactored
  * 31/03/2023:		Added wait_VDP
+ * 16/10/2026:		Added wait_VDPreply
  */
 
 #ifndef TIMER_H
@@ -16,11 +17,13 @@
 
 extern long 	SysClkFreq;
 extern volatile BYTE vpd_protocol_flags;		// In globals.asm
+extern volatile BYTE vdp_protocol_seq[];		// In globals.asm
 
 unsigned short  init_timer0(int interval, int clkdiv, unsigned char ctrlbits);
 void            enable_timer0(unsigned char enable);
 unsigned short  get_timer0();
 BOOL 			wait_VDP(unsigned char mask);
+BOOL			wait_VDPreply(BYTE seq, BYTE count);
 
 void            wait_timer0();  // In misc.asm
 
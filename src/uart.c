@@ -2,7 +2,7 @@
  * Title:			AGON MOS - UART code
  * Author:			Dean Belfield
  * Created:			06/07/2022
- * Last Updated:	08/04/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 03/08/2022:		Enabled UART0 receive interrupt
@@ -11,6 +11,8 @@
  * 23/03/2023:		Fixed maths overflow in init_UART0 to work with bigger baud rates
  * 28/03/2023:		Added support for UART1
  * 08/04/2023:		Interrupts now disabled in close_UART1
+ * 16/10/2026:		Asking open_UART0 for the transmit interrupt enables the transmit buffer
+ *					Added setTrigger_UART0
  *
  * NB:
  * The UART is on Port D
@@ -27,6 +29,7 @@
 #include <defines.h>
 #include <gpio.h>
 
+#include "config.h"
 #include "uart.h"
  
 // Set the Line Control Register for data, stop and parity bits
@@ -34,6 +37,24 @@
 #define SETREG_LCR0(data, stop, parity) (UART0_LCTL = ((BYTE)(((data)-(BYTE)5)&(BYTE)0x3)|(BYTE)((((stop)-(BYTE)0x1)&(BYTE)0x1)<<(BYTE)0x2)|(BYTE)((parity)<<(BYTE)0x3)))
 #define SETREG_LCR1(data, stop, parity) (UART1_LCTL = ((BYTE)(((data)-(BYTE)5)&(BYTE)0x3)|(BYTE)((((stop)-(BYTE)0x1)&(BYTE)0x1)<<(BYTE)0x2)|(BYTE)((parity)<<(BYTE)0x3)))
 
+BYTE	uart0_rxTrigger = MOS_uart0RxTrigger;						// The UART0 receive FIFO trigger level
+
+// Get the FCTL bits for a receive FIFO trigger level
+// Parameters:
+// - level: Number of bytes (1, 4, 8 or 14)
+// Returns:
+// - The TRIG bits, or 0xFF if the level is not valid
+//
+static BYTE trigger_bits(BYTE level) {
+	switch(level) {
+		case  1: return UART_FCTL_TRIG_1;
+		case  4: return UART_FCTL_TRIG_4;
+		case  8: return UART_FCTL_TRIG_8;
+		case 14: return UART_FCTL_TRIG_14;
+	}
+	return 0xFF;
+}
+
 void init_UART0() {
 	PD_DR = PORTD_DRVAL_DEF;
 	PD_DDR = PORTD_DDRVAL_DEF;
@@ -68,6 +89,8 @@ BYTE open_UART0(UART * pUART) {
 	UCHAR	pins = PORTPIN_ZERO | PORTPIN_ONE;						// The transmit and receive pins											
 
 	serialFlags &= 0xF0;
+	uart0_txhead = 0;												// Empty the transmit buffer
+	uart0_txtail = 0;
 	
 	SETREG(PD_DDR, pins);											// Set Port D bits 0, 1 (TX. RX) for alternate function.
 	RESETREG(PD_ALT1, pins);
@@ -85,16 +108,39 @@ BYTE open_UART0(UART * pUART) {
 	UART0_BRG_H = (CHAR)(( br & 0xFF00 ) >> 8);						// Load divisor high
 	UART0_LCTL &= (~UART_LCTL_DLAB); 								// Reset DLAB; dont disturb other bits
 	UART0_MCTL = 0x00;												// Bring modem control register to reset value
-	UART0_FCTL = 0x07;												// Enable and clear hardware FIFOs
-	UART0_IER = pUART->interrupts;									// Set interrupts
+	UART0_FCTL = 0x07 | trigger_bits(uart0_rxTrigger);				// Enable and clear hardware FIFOs, and set the receive trigger level
+	UART0_IER = pUART->interrupts & ~UART_IER_TRANSMITINT;			// Set interrupts; the transmit interrupt is enabled on demand
 	
 	SETREG_LCR0(pUART->dataBits, pUART->stopBits, pUART->parity);	// Set the line status register
 
+	if(pUART->interrupts & UART_IER_TRANSMITINT) {
+		serialFlags |= 0x04;										// Output goes through the transmit buffer
+	}
 	serialFlags |= 0x01;
 	
 	return UART_ERR_NONE;
 }
 
+// Set the UART0 receive FIFO trigger level
+// Bytes below the trigger level are picked up by the receive timeout interrupt
+// Parameters:
+// - level: Number of bytes in the FIFO that raise an interrupt (1, 4, 8 or 14)
+// Returns:
+// - UART_ERR_NONE, or UART_ERR_INVTRIGGERLEVEL if the level is not valid
+//
+BYTE setTrigger_UART0(BYTE level) {
+	BYTE trig = trigger_bits(level);
+
+	if(trig == 0xFF) {
+		return UART_ERR_INVTRIGGERLEVEL;
+	}
+	uart0_rxTrigger = level;
+	if(serialFlags & 0x01) {
+		UART0_FCTL = UART_FCTL_FIFOEN | trig;						// Keep the FIFOs enabled, without clearing them
+	}
+	return UART_ERR_NONE;
+}
+
 // Open UART1
 // Parameters:
 // - pUART: Structure containing the initialisation data
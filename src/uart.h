@@ -2,13 +2,15 @@
  * Title:			AGON MOS - UART code
  * Author:			Dean Belfield
  * Created:			06/07/2022
- * Last Updated:	16/05/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 22/03/2023:		Moved putch and getch to serial.asm
  * 23/03/2023:		Fixed maths overflow in init_UART0 to work with bigger baud rates
  * 29/03/2023:		Added support for UART1
  * 16/05/2023:		Fixed MASTERCLOCK
+ * 16/10/2026:		Added UART0_writeBlock, UART0_flush
+ *					Added setTrigger_UART0, uart0_rxTrigger, uart0_irqCount, uart0_rxCount
  */
 
 #ifndef UART_H
@@ -174,11 +176,22 @@ void init_UART1();
 BYTE open_UART0(UART * pUART);
 BYTE open_UART1(UART * pUART);
 
+BYTE setTrigger_UART0(BYTE level);
+
 void close_UART1();
 
 extern volatile BYTE serialFlags;		// In globals.asm
+extern volatile BYTE uart0_txhead;
+extern volatile BYTE uart0_txtail;
+extern volatile UINT24 uart0_irqCount;
+extern volatile UINT24 uart0_rxCount;
+
+extern BYTE uart0_rxTrigger;			// In uart.c
 
 extern INT putch(INT ich);				// Now in serial.asm
 extern INT getch(VOID);					// Now in serial.asm
 
+extern UINT UART0_writeBlock(const BYTE * buf, UINT len);	// In serial.asm
+extern void UART0_flush(void);							// In serial.asm
+
 #endif UART_H
\ No newline at end of file
@@ -2,7 +2,7 @@
 ; Title:	AGON MOS - VDP serial protocol
 ; Author:	Dean Belfield
 ; Created:	03/08/2022
-; Last Updated:	26/09/2023
+; Last Updated:	16/10/2026
 ;
 ; Modinfo:
 ; 09/08/2022:	Added vdp_protocol_CURSOR
@@ -19,6 +19,8 @@
 ; 03/08/2023:	Added user_kbvector in vdp_protocol_KEY
 ; 13/08/2023:	Moved keyboard handling to keyboard.asm
 ; 26/09/2023:	RTC packet length reduced to 6 bytes
+; 16/10/2026:	Packets that set vpd_protocol_flags also increment their counter in vdp_protocol_seq
+;		Added vdp_protocol_snoop; MODE packets reset vdp_shadow
 
 			INCLUDE	"macros.inc"
 			INCLUDE	"equs.inc"
@@ -29,6 +31,7 @@
 			SEGMENT .STARTUP
 			
 			XDEF	vdp_protocol
+			XDEF	vdp_protocol_snoop
 
 			XREF	_keyascii
 			XREF	_keycode
@@ -60,6 +63,9 @@
 			XREF	_vdp_protocol_len
 			XREF	_vdp_protocol_ptr
 			XREF	_vdp_protocol_data
+			XREF	_vdp_protocol_seq
+			XREF	_vdp_shadow
+			XREF	_vdp_txcount
 
 			XREF	_user_kbvector
 
@@ -165,6 +171,8 @@ vdp_protocol_state3:	LD	A, (_vdp_protocol_len)
 ;
 vdp_protocol_GP:	LD	A, (_vdp_protocol_data + 0)
 			LD	(_gp), A
+			XOR	A			; The VDP may have been reset, so
+			LD	(_vdp_shadow), A	; Forget the shadow state
 			RET
 
 ; Keyboard Data
@@ -212,6 +220,8 @@ vdp_protocol_CURSOR:	LD	A, (_vdp_protocol_data+0)
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_CURSOR
 			LD	(_vpd_protocol_flags), A
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_CURSOR
+			INC	(HL)			; Count the reply
 			RET
 			
 ; Screen character data
@@ -226,6 +236,8 @@ vpd_protocol_SCRCHAR:	LD	A, (_vdp_protocol_data+0)
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_SCRCHAR
 			LD	(_vpd_protocol_flags), A
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_SCRCHAR
+			INC	(HL)			; Count the reply
 			RET
 			
 ; Pixel value data (RGB)
@@ -245,6 +257,8 @@ vdp_protocol_POINT:	LD	HL, (_vdp_protocol_data+0)
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_POINT
 			LD	(_vpd_protocol_flags), A
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_POINT
+			INC	(HL)			; Count the reply
 			RET
 			
 ; Audio acknowledgement
@@ -262,6 +276,8 @@ vdp_protocol_AUDIO:	LD	A, (_vdp_protocol_data+0)
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_AUDIO
 			LD	(_vpd_protocol_flags), A
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_AUDIO
+			INC	(HL)			; Count the reply
 			RET
 			
 ; Screen mode details
@@ -295,6 +311,10 @@ vdp_protocol_MODE:	LD	A, (_vdp_protocol_data+0)
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_MODE
 			LD	(_vpd_protocol_flags), A			
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_MODE
+			INC	(HL)			; Count the reply
+			XOR	A			; The mode may have changed, which resets the cursor and colours
+			LD	(_vdp_shadow), A	; getModeInformation marks the mode valid if it can trust this reply
 			RET
 
 ; RTC
@@ -311,6 +331,8 @@ vdp_protocol_RTC:	LD	HL, _vdp_protocol_data
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_RTC
 			LD	(_vpd_protocol_flags), A			
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_RTC
+			INC	(HL)			; Count the reply
 			RET
 
 ; Keyboard status
@@ -343,4 +365,29 @@ vdp_protocol_MOUSE:	LD	HL, _vdp_protocol_data
 			LD	A, (_vpd_protocol_flags)
 			OR	VDPP_FLAG_MOUSE
 			LD	(_vpd_protocol_flags), A
+			LD	HL, _vdp_protocol_seq + VDPP_SEQ_MOUSE
+			INC	(HL)			; Count the reply
+			RET
+
+; Forget any shadow VDP state that a byte sent to the VDP may change
+; Called for every byte written with UART0_serial_PUTCH
+; Parameters:
+; - A: The byte
+; Corrupts:
+; - F
+;
+vdp_protocol_snoop:	PUSH	HL
+			LD	HL, _vdp_txcount
+			INC	(HL)			; Count the byte
+			LD	HL, _vdp_shadow
+			RES	VDPS_CURSOR, (HL)	; Anything may move the cursor
+			CP	17			; VDU 17 sets a text colour
+			JR	Z, $F
+			CP	20			; VDU 20 resets the colours
+			JR	Z, $F
+			CP	22			; VDU 22 changes the mode, which resets them
+			JR	NZ, vdp_protocol_snoop1
+			RES	VDPS_MODE, (HL)
+$$:			RES	VDPS_COLOURS, (HL)
+vdp_protocol_snoop1:	POP	HL
 			RET
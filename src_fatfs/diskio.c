@@ -2,7 +2,7 @@
  * Title:			AGON Low level disk I/O module for FatFs 
  * Modified By:		Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	15/03/2023
+ * Last Updated:	16/10/2026
  *
  * Credits:
  * Based upon a skeleton framework (C)ChaN, 2019
@@ -11,16 +11,339 @@
  * 11/07/2023:		Tweaked to compile without ZDL enabled in project settings
  * 15/03/2023:		Added get_fattime
  * 10/05/2024:		Fixed get_fattime for new RTC format.
+ * 16/10/2026:		CTRL_SYNC waits for the SD card to finish any pending write
+ *					Added write-back LRU sector cache
+ *					Added sequential read-ahead
+ *					Implemented GET_SECTOR_COUNT, GET_SECTOR_SIZE, GET_BLOCK_SIZE and CTRL_TRIM
+ *					Card identification runs at 384KHz, then the SPI clock is set from TRAN_SPEED
+ *					Implemented MMC_GET_CSD, MMC_GET_CID, MMC_GET_OCR and MMC_GET_SDSTAT
+ *					disk_initialize discards the sector cache rather than writing it to a card that may have changed
  */
 
+#include <string.h>
+
 #include "ff.h"			// Obtains integer types
 #include "diskio.h"		// Declarations of disk functions
 
 #include "sd.h"			// Physical SD card layer for eZ80
+#include "spi.h"
+#include "uart.h"		// For MASTERCLOCK
 #include "clock.h"		// Clock for timestamp
+#include "config.h"
+#include "umm_malloc.h"
 
 extern BYTE rtc;		// In globals.asm
 
+#if MOS_diskCacheSectors > 0
+
+// Sector cache
+// Single sector reads and writes go through a small write-back cache; these are
+// mostly the FAT and directory sectors that FatFS keeps coming back to
+//
+typedef struct {
+	LBA_t	sector;			// Sector held in this slot
+	DWORD	used;			// Value of cache_clock when last used
+	BYTE	valid;			// Slot holds a sector
+	BYTE	dirty;			// Slot has not been written back to the card yet
+} t_diskCacheSlot;
+
+#define CACHE_BUFFER(i)	(cache_data + (UINT)(i) * FF_MAX_SS)
+
+static t_diskCacheSlot	cache_slot[MOS_diskCacheSectors];
+static BYTE *			cache_data = NULL;	// Allocated on the MOS heap by disk_initialize
+static DWORD			cache_clock = 0;
+
+DWORD	disk_cacheHits = 0;
+DWORD	disk_cacheMisses = 0;
+
+// Find a sector in the cache
+// Returns:
+// - Slot index, or -1 if the sector is not cached
+//
+static int cache_find(LBA_t sector) {
+	int i;
+
+	for(i = 0; i < MOS_diskCacheSectors; i++) {
+		if(cache_slot[i].valid && cache_slot[i].sector == sector) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Write a slot back to the card if it is dirty
+//
+static DRESULT cache_writeBack(int i) {
+	if(cache_slot[i].valid && cache_slot[i].dirty) {
+		if(SD_writeBlocks(cache_slot[i].sector, CACHE_BUFFER(i), 1) != SD_SUCCESS) {
+			return RES_ERROR;
+		}
+		cache_slot[i].dirty = 0;
+	}
+	return RES_OK;
+}
+
+// Write all dirty slots back to the card
+//
+static DRESULT cache_flush(void) {
+	DRESULT	res = RES_OK;
+	int		i;
+
+	for(i = 0; i < MOS_diskCacheSectors; i++) {
+		if(cache_writeBack(i) != RES_OK) {
+			res = RES_ERROR;
+		}
+	}
+	return res;
+}
+
+// Deal with cached copies of sectors about to be transferred directly to or from the card
+// Parameters:
+// - sector: Start sector in LBA
+// - count: Number of sectors
+// - discard: 0 to write dirty copies back first (read), 1 to drop them (write)
+//
+static DRESULT cache_flushRange(LBA_t sector, UINT count, BYTE discard) {
+	int	i;
+
+	for(i = 0; i < MOS_diskCacheSectors; i++) {
+		if(cache_slot[i].valid && cache_slot[i].sector >= sector && cache_slot[i].sector - sector < count) {
+			if(discard) {
+				cache_slot[i].valid = 0;
+			}
+			else if(cache_writeBack(i) != RES_OK) {
+				return RES_ERROR;
+			}
+		}
+	}
+	return RES_OK;
+}
+
+// Pick a slot for a new sector; an empty one, otherwise the least recently used
+// Returns:
+// - Slot index, or -1 if the slot could not be written back
+//
+static int cache_victim(void) {
+	int	i;
+	int	v = 0;
+
+	for(i = 0; i < MOS_diskCacheSectors; i++) {
+		if(!cache_slot[i].valid) {
+			return i;
+		}
+		if(cache_slot[i].used < cache_slot[v].used) {
+			v = i;
+		}
+	}
+	if(cache_writeBack(v) != RES_OK) {
+		return -1;
+	}
+	cache_slot[v].valid = 0;
+	return v;
+}
+
+// Copy a single sector from the cache
+// Returns:
+// - 1 if the sector was in the cache, otherwise 0
+//
+static BYTE cache_hit(BYTE *buff, LBA_t sector) {
+	int	i = cache_find(sector);
+
+	if(i < 0) {
+		return 0;
+	}
+	disk_cacheHits++;
+	cache_slot[i].used = ++cache_clock;
+	memcpy(buff, CACHE_BUFFER(i), FF_MAX_SS);
+	return 1;
+}
+
+// Read a single sector that is not in the cache from the card, and keep a copy
+//
+static DRESULT cache_load(BYTE *buff, LBA_t sector) {
+	int	i;
+
+	disk_cacheMisses++;
+	i = cache_victim();
+	if(i < 0 || SD_readBlocks(sector, CACHE_BUFFER(i), 1) != SD_SUCCESS) {
+		return RES_ERROR;
+	}
+	cache_slot[i].sector = sector;
+	cache_slot[i].valid = 1;
+	cache_slot[i].dirty = 0;
+	cache_slot[i].used = ++cache_clock;
+	memcpy(buff, CACHE_BUFFER(i), FF_MAX_SS);
+	return RES_OK;
+}
+
+// Write a single sector into the cache; it is written to the card later
+//
+static DRESULT cache_write(const BYTE *buff, LBA_t sector) {
+	int	i = cache_find(sector);
+
+	if(i >= 0) {
+		disk_cacheHits++;
+	}
+	else {
+		disk_cacheMisses++;
+		i = cache_victim();
+		if(i < 0) {
+			return RES_ERROR;
+		}
+		cache_slot[i].sector = sector;
+		cache_slot[i].valid = 1;
+	}
+	cache_slot[i].dirty = 1;
+	cache_slot[i].used = ++cache_clock;
+	memcpy(CACHE_BUFFER(i), buff, FF_MAX_SS);
+	return RES_OK;
+}
+
+#endif
+
+#if MOS_diskReadAhead > 0
+
+// Read-ahead buffer
+// When single sector reads walk through consecutive sectors, as they do when a file is
+// streamed in small chunks, the following sectors are fetched with one multiple block read.
+// Sectors served from here are not put in the cache, so streaming doesn't flush it
+//
+#define RA_BUFFER(i)	(ra_data + (UINT)(i) * FF_MAX_SS)
+
+static BYTE *	ra_data = NULL;		// Allocated on the MOS heap by disk_initialize
+static LBA_t	ra_sector;			// First sector in the buffer
+static UINT		ra_count = 0;		// Number of sectors in the buffer
+static LBA_t	ra_last = 0;		// Last single sector read from the card or the buffer
+
+DWORD	disk_readAheadHits = 0;
+DWORD	disk_readAheadFetches = 0;
+
+// Forget any buffered sectors in a range that is being written
+//
+static void ra_discard(LBA_t sector, UINT count) {
+	if(ra_count && sector < ra_sector + ra_count && ra_sector < sector + count) {
+		ra_count = 0;
+	}
+}
+
+// Serve a single sector from the read-ahead buffer, filling it first if the read is sequential
+// Returns:
+// - 1 if the sector was copied into buff, 0 if it should be read some other way
+//
+static BYTE ra_read(BYTE *buff, LBA_t sector) {
+	BYTE seq = sector == ra_last + 1 || (ra_count && sector == ra_sector + ra_count);
+
+	ra_last = sector;
+	if(ra_count && sector >= ra_sector && sector - ra_sector < ra_count) {
+		disk_readAheadHits++;
+	}
+	else {
+		if(!seq) {
+			return 0;
+		}
+		ra_count = 0;
+#if MOS_diskCacheSectors > 0
+		if(cache_data && cache_flushRange(sector, MOS_diskReadAhead, 0) != RES_OK) {
+			return 0;
+		}
+#endif
+		if(SD_readBlocks(sector, ra_data, MOS_diskReadAhead) != SD_SUCCESS) {
+			return 0;				// Probably ran off the end of the card
+		}
+		ra_sector = sector;
+		ra_count = MOS_diskReadAhead;
+		disk_readAheadFetches++;
+	}
+	memcpy(buff, RA_BUFFER(sector - ra_sector), FF_MAX_SS);
+	return 1;
+}
+
+#endif
+
+// Get the size of the card from its CSD register
+// Returns:
+// - Number of sectors
+//
+static LBA_t csd_sectorCount(BYTE *csd) {
+	DWORD	c_size;
+	BYTE	n;
+
+	if((csd[0] >> 6) == 1) {		// CSD version 2.0 (SDHC/SDXC)
+		c_size = ((DWORD)(csd[7] & 0x3F) << 16) | ((WORD)csd[8] << 8) | csd[9];
+		return (c_size + 1) << 10;
+	}
+	c_size = ((WORD)(csd[6] & 0x03) << 10) | ((WORD)csd[7] << 2) | (csd[8] >> 6);
+	n = (csd[5] & 0x0F) + ((csd[9] & 0x03) << 1) + (csd[10] >> 7) + 2;	// READ_BL_LEN + C_SIZE_MULT + 2
+	return (c_size + 1) << (n - 9);
+}
+
+// Get the erase block size of the card from its CSD register
+// Returns:
+// - Number of sectors
+//
+static DWORD csd_eraseBlockSize(BYTE *csd) {
+	BYTE	sector_size = (((csd[10] & 0x3F) << 1) | (csd[11] >> 7)) + 1;		// In units of write blocks
+	BYTE	write_bl_len = ((csd[12] & 0x03) << 2) | (csd[13] >> 6);
+
+	return (DWORD)sector_size << (write_bl_len - 9);
+}
+
+// Get the SPI divisor for the fastest clock the card supports, from the TRAN_SPEED field of its CSD register
+// Returns:
+// - SPI baud rate generator divisor
+//
+static UINT16 csd_spiDivisor(BYTE *csd) {
+	static const BYTE	time_value[16] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };
+	BYTE	unit = csd[3] & 0x07;	// 0: 100Kbit/s, 1: 1Mbit/s, 2: 10Mbit/s, 3: 100Mbit/s
+	DWORD	hz = time_value[(csd[3] >> 3) & 0x0F] * 10000L;
+	DWORD	divisor;
+
+	if(hz == 0) {
+		return SPI_DIVISOR_INIT;
+	}
+	for(unit = unit > 3 ? 3 : unit; unit > 0; unit--) {
+		hz *= 10;
+	}
+	divisor = (MASTERCLOCK + 2 * hz - 1) / (2 * hz);
+	return divisor < SPI_DIVISOR_MIN ? SPI_DIVISOR_MIN : (UINT16)divisor;
+}
+
+#if MOS_sdSpeedTest > 0
+
+// Check that the card can be read reliably with an SPI divisor, slowing down until it can
+// Sector 0 is read at the card identification rate first, then compared with reads at the faster rates
+// Parameters:
+// - divisor: SPI divisor to try first
+// Returns:
+// - SPI divisor to use
+//
+static UINT16 spi_speedTest(UINT16 divisor) {
+	BYTE *	ref = umm_malloc(2 * FF_MAX_SS);
+	BYTE *	buf = ref + FF_MAX_SS;
+	BYTE	i;
+
+	if(ref == NULL) {
+		return divisor;
+	}
+	if(SD_readBlocks(0, ref, 1) == SD_SUCCESS) {
+		for(; divisor < SPI_DIVISOR_INIT; divisor++) {
+			spi_setDivisor(divisor);
+			for(i = 0; i < 4; i++) {
+				if(SD_readBlocks(0, buf, 1) != SD_SUCCESS || memcmp(ref, buf, FF_MAX_SS) != 0) {
+					break;
+				}
+			}
+			if(i == 4) {
+				break;
+			}
+		}
+	}
+	umm_free(ref);
+	return divisor;
+}
+
+#endif
+
 // Get Drive Status (Not implemented in AGON)
 // Parameters:
 // - pdrv: Physical drive number to identify the drive
@@ -38,11 +361,35 @@ DSTATUS disk_status(BYTE pdrv) {
 // - DSTATUS
 //
 DSTATUS disk_initialize(BYTE pdrv) {
-	BYTE err = SD_init();
-	if(err == SD_SUCCESS) {
-		return RES_OK;
+	BYTE	err;
+	BYTE	csd[16];
+	UINT16	divisor = SPI_DIVISOR_INIT;
+
+#if MOS_diskCacheSectors > 0
+	if(cache_data == NULL) {
+		cache_data = umm_malloc(MOS_diskCacheSectors * FF_MAX_SS);	// If this fails, run without the cache
 	}
-	return RES_ERROR;
+	memset(cache_slot, 0, sizeof(cache_slot));						// The card may have changed, so discard; f_sync and f_unmount write back
+#endif
+#if MOS_diskReadAhead > 0
+	if(ra_data == NULL) {
+		ra_data = umm_malloc(MOS_diskReadAhead * FF_MAX_SS);		// If this fails, run without read-ahead
+	}
+	ra_count = 0;
+#endif
+	spi_setDivisor(SPI_DIVISOR_INIT);	// Card identification must run at 400KHz or less
+	err = SD_init();
+	if(err != SD_SUCCESS) {
+		return RES_ERROR;
+	}
+	if(SD_readCSD(csd) == SD_SUCCESS) {
+		divisor = csd_spiDivisor(csd);
+	}
+#if MOS_sdSpeedTest > 0
+	divisor = spi_speedTest(divisor);
+#endif
+	spi_setDivisor(divisor);
+	return RES_OK;
 }
 
 // Read Sector(s)
@@ -55,7 +402,31 @@ DSTATUS disk_initialize(BYTE pdrv) {
 // - DSTATUS
 //
 DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
-	BYTE err = SD_readBlocks(sector, buff, count);
+	BYTE err;
+
+	if(count == 1) {
+#if MOS_diskCacheSectors > 0
+		if(cache_data && cache_hit(buff, sector)) {
+			return RES_OK;
+		}
+#endif
+#if MOS_diskReadAhead > 0
+		if(ra_data && ra_read(buff, sector)) {
+			return RES_OK;
+		}
+#endif
+#if MOS_diskCacheSectors > 0
+		if(cache_data) {
+			return cache_load(buff, sector);
+		}
+#endif
+	}
+#if MOS_diskCacheSectors > 0
+	else if(cache_data && cache_flushRange(sector, count, 0) != RES_OK) {	// The card must have the latest copy
+		return RES_ERROR;
+	}
+#endif
+	err = SD_readBlocks(sector, buff, count);
 	if(err == SD_SUCCESS) {
 		return RES_OK;
 	}
@@ -74,7 +445,20 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
 // - DSTATUS
 //
 DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count){
-	BYTE err = SD_writeBlocks(sector, buff, count);
+	BYTE err;
+
+#if MOS_diskReadAhead > 0
+	ra_discard(sector, count);
+#endif
+#if MOS_diskCacheSectors > 0
+	if(cache_data) {
+		if(count == 1) {
+			return cache_write(buff, sector);
+		}
+		cache_flushRange(sector, count, 1);					// About to be overwritten
+	}
+#endif
+	err = SD_writeBlocks(sector, buff, count);
 	if(err == SD_SUCCESS) {
 		return RES_OK;
 	}
@@ -84,7 +468,7 @@ DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count){
 
 #endif
 
-// Disk I/O Control (Not implemented in AGON)
+// Disk I/O Control
 // Parameters:
 // - pdrv: Physical drive nmuber (0..)
 // - cmd: Control code
@@ -93,6 +477,77 @@ DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count){
 // - DSTATUS
 //
 DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+	BYTE	csd[16];
+	LBA_t *	range;
+
+	switch(cmd) {
+		case CTRL_SYNC:			// Writes return before the card has finished programming
+#if MOS_diskCacheSectors > 0
+			if(cache_data && cache_flush() != RES_OK) {
+				return RES_ERROR;
+			}
+#endif
+			if(SD_sync() != SD_SUCCESS) {
+				return RES_ERROR;
+			}
+			break;
+
+		case GET_SECTOR_COUNT:	// Size of the card in sectors
+			if(SD_readCSD(csd) != SD_SUCCESS) {
+				return RES_ERROR;
+			}
+			*(LBA_t *)buff = csd_sectorCount(csd);
+			break;
+
+		case GET_SECTOR_SIZE:
+			*(WORD *)buff = FF_MAX_SS;
+			break;
+
+		case GET_BLOCK_SIZE:	// Erase block size in sectors
+			if(SD_readCSD(csd) != SD_SUCCESS) {
+				return RES_ERROR;
+			}
+			*(DWORD *)buff = csd_eraseBlockSize(csd);
+			break;
+
+		case MMC_GET_CSD:		// 16 byte CSD register
+			return SD_readCSD((BYTE *)buff) == SD_SUCCESS ? RES_OK : RES_ERROR;
+
+		case MMC_GET_CID:		// 16 byte CID register
+			return SD_readCID((BYTE *)buff) == SD_SUCCESS ? RES_OK : RES_ERROR;
+
+		case MMC_GET_OCR:		// 4 byte OCR register
+			SD_readOCR(csd);	// csd[0] is the R1 response
+			if(csd[0] > 1) {
+				return RES_ERROR;
+			}
+			memcpy(buff, csd + 1, 4);
+			break;
+
+		case MMC_GET_SDSTAT:	// 64 byte SD status
+			return SD_readSDStatus((BYTE *)buff) == SD_SUCCESS ? RES_OK : RES_ERROR;
+
+		case CTRL_TRIM:			// Erase the sectors range[0] to range[1] inclusive
+			range = (LBA_t *)buff;
+			if(SD_readCSD(csd) != SD_SUCCESS || !(csd[10] & 0x40)) {	// ERASE_BLK_EN: can erase single blocks
+				return RES_ERROR;
+			}
+#if MOS_diskReadAhead > 0
+			ra_discard(range[0], range[1] - range[0] + 1);
+#endif
+#if MOS_diskCacheSectors > 0
+			if(cache_data) {
+				cache_flushRange(range[0], range[1] - range[0] + 1, 1);
+			}
+#endif
+			if(SD_erase(range[0], range[1]) != SD_SUCCESS) {
+				return RES_ERROR;
+			}
+			break;
+
+		default:
+			return RES_PARERR;
+	}
 	return RES_OK;
 }
 
@@ -2,13 +2,14 @@
  * Title:			AGON Low level disk interface modlue include file
  * Modified By:		Dean Belfield
  * Created:			19/06/2022
- * Last Updated:	15/03/2023
+ * Last Updated:	16/10/2026
  *
  * Credits:
  * Based upon a skeleton framework (C)ChaN, 2019
  *
  * Modinfo:
  * 15/03/2023:	 	Added get_fattime
+ * 16/10/2026:		Added sector cache and read-ahead counters
  */
 
 #ifndef _DISKIO_DEFINED
@@ -44,6 +45,13 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 //
 DWORD get_fattime(void);
 
+// Sector cache and read-ahead statistics
+//
+extern DWORD disk_cacheHits;
+extern DWORD disk_cacheMisses;
+extern DWORD disk_readAheadHits;
+extern DWORD disk_readAheadFetches;
+
 // Disk Status Bits (DSTATUS)
 //
 #define STA_NOINIT		0x01	// Drive not initialized */
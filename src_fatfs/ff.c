@@ -35,6 +35,21 @@
 #endif
 
 
+/* Cluster link map table of a file, kept in its extension (Agon) */
+#if FF_USE_FASTSEEK
+#define CLTBL(fp)	get_cltbl(fp)
+#endif
+
+/* File data goes through the shared window fs->win[] rather than the file's own buffer */
+#if FF_FS_TINY
+#define FBUF(fp)		get_fbuf(fp)	/* Private buffer given by f_setbuf(), kept in the file's extension */
+#define SHARED_WIN(fp)	(FBUF(fp) == 0)	/* Unless a private buffer has been given by f_setbuf() */
+#else
+#define FBUF(fp)		((fp)->buf)
+#define SHARED_WIN(fp)	0
+#endif
+
+
 /* Limits and boundaries */
 #define MAX_DIR		0x200000		/* Max size of FAT directory */
 #define MAX_DIR_EX	0x10000000		/* Max size of exFAT directory */
@@ -1070,6 +1085,162 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 
+#if FF_FS_TINY
+/*-----------------------------------------------------------------------*/
+/* Get the private sector buffer of a file                               */
+/*-----------------------------------------------------------------------*/
+
+static BYTE* get_fbuf (	/* 0:Shared window, others:Pointer to the private buffer */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	FILX *fx = ff_filext(fp);
+
+
+	return fx ? fx->buf : 0;	/* Files without an extension use the shared window */
+}
+#endif
+
+
+
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Write back the private sector buffer of a file                        */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT flush_buf (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,		/* Filesystem object */
+	FIL* fp			/* File object with a private buffer */
+)
+{
+	if (fp->flag & FA_DIRTY) {	/* Is the sector buffer dirty? */
+		if (disk_write(fs->pdrv, FBUF(fp), fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+		fp->flag &= (BYTE)~FA_DIRTY;
+#if FF_FS_TINY
+		if (fs->winsect == fp->sect) memcpy(fs->win, FBUF(fp), SS(fs));	/* Keep the shared window coherent */
+#endif
+	}
+	return FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT sector cache (Agon)                                               */
+/*-----------------------------------------------------------------------*/
+/* FAT sectors are cached apart from win[], so that following a cluster
+/  chain does not evict the directory sector being worked on. */
+
+#if FF_FAT_CACHE && !FF_FS_READONLY
+static FRESULT sync_fatslot (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,		/* Filesystem object */
+	UINT i			/* Cache slot to write back */
+)
+{
+	BYTE *buf = fs->fcbuf + i * SS(fs);
+
+
+	if (fs->fcflag[i] & 1) {	/* Is the slot dirty? */
+		if (disk_write(fs->pdrv, buf, fs->fcsect[i], 1) != RES_OK) return FR_DISK_ERR;
+		if (fs->n_fats == 2) disk_write(fs->pdrv, buf, fs->fcsect[i] + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+		fs->fcflag[i] = 0;
+	}
+	return FR_OK;
+}
+
+
+static FRESULT sync_fatcache (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	if (fs->fcbuf) {
+		for (i = 0; i < FF_FAT_CACHE; i++) {
+			if (sync_fatslot(fs, i) != FR_OK) return FR_DISK_ERR;
+		}
+	}
+	return FR_OK;
+}
+#endif
+
+
+static BYTE* fat_sector (	/* Pointer to the sector data, 0:Disk error */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect,		/* FAT sector to access */
+	int wr			/* 1:The sector is going to be modified */
+)
+{
+#if FF_FAT_CACHE
+	UINT i, v;
+
+
+	if (!fs->fcbuf)
+#endif
+	{							/* No cache: use the window */
+		if (move_window(fs, sect) != FR_OK) return 0;
+		if (wr) fs->wflag = 1;
+		return fs->win;
+	}
+#if FF_FAT_CACHE
+	for (i = v = 0; i < FF_FAT_CACHE; i++) {
+		if (fs->fcsect[i] == sect) break;	/* Hit? */
+		if ((WORD)(fs->fcclock - fs->fcuse[i]) > (WORD)(fs->fcclock - fs->fcuse[v])) v = i;	/* Least recently used slot */
+	}
+	if (i < FF_FAT_CACHE) {
+		fs->fchit++;
+	} else {
+		fs->fcmiss++;
+		i = v;
+#if !FF_FS_READONLY
+		if (sync_fatslot(fs, i) != FR_OK) return 0;	/* Write back the slot being replaced */
+#endif
+		fs->fcsect[i] = sect;
+		if (disk_read(fs->pdrv, fs->fcbuf + i * SS(fs), sect, 1) != RES_OK) {
+			fs->fcsect[i] = (LBA_t)0 - 1;	/* Invalidate the slot if read data is not valid */
+			return 0;
+		}
+	}
+	fs->fcuse[i] = ++fs->fcclock;
+	if (wr) fs->fcflag[i] = 1;
+	return fs->fcbuf + i * SS(fs);
+#endif
+}
+
+
+
+
+#if FF_FAT_FREEMAP && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Map of the FAT regions with no free cluster (Agon)                    */
+/*-----------------------------------------------------------------------*/
+
+static void set_freemap (
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* A cluster in the region */
+	int full		/* 1:The region has no free cluster, 0:It may have */
+)
+{
+	DWORD r = clst >> fs->fmshift;
+
+
+	if (full) {
+		fs->fmap[r / 8] |= 1 << (r % 8);
+	} else {
+		fs->fmap[r / 8] &= ~(1 << (r % 8));
+	}
+}
+
+#define chk_freemap(fs, clst)	((fs)->fmap[((clst) >> (fs)->fmshift) / 8] & (1 << (((clst) >> (fs)->fmshift) % 8)))
+#define end_freemap(fs, clst)	(((clst) | (((DWORD)1 << (fs)->fmshift) - 1)) >= (fs)->n_fatent - 1 ? (fs)->n_fatent - 1 : ((clst) | (((DWORD)1 << (fs)->fmshift) - 1)))
+#endif
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Synchronize filesystem and data on the storage                        */
@@ -1083,6 +1254,9 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	res = sync_window(fs);
+#if FF_FAT_CACHE
+	if (res == FR_OK) res = sync_fatcache(fs);
+#endif
 	if (res == FR_OK) {
 		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {	/* FAT32: Update FSInfo sector if needed */
 			/* Create FSInfo structure */
@@ -1135,6 +1309,7 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 {
 	UINT wc, bc;
 	DWORD val;
+	BYTE *p;
 	FATFS *fs = obj->fs;
 
 
@@ -1147,21 +1322,21 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
-			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
-			wc = fs->win[bc++ % SS(fs)];		/* Get 1st byte of the entry */
-			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
-			wc |= fs->win[bc % SS(fs)] << 8;	/* Merge 2nd byte of the entry */
+			if ((p = fat_sector(fs, fs->fatbase + (bc / SS(fs)), 0)) == 0) break;
+			wc = p[bc++ % SS(fs)];				/* Get 1st byte of the entry */
+			if ((p = fat_sector(fs, fs->fatbase + (bc / SS(fs)), 0)) == 0) break;
+			wc |= p[bc % SS(fs)] << 8;			/* Merge 2nd byte of the entry */
 			val = (clst & 1) ? (wc >> 4) : (wc & 0xFFF);	/* Adjust bit position */
 			break;
 
 		case FS_FAT16 :
-			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2))) != FR_OK) break;
-			val = ld_word(fs->win + clst * 2 % SS(fs));		/* Simple WORD array */
+			if ((p = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 2)), 0)) == 0) break;
+			val = ld_word(p + clst * 2 % SS(fs));		/* Simple WORD array */
 			break;
 
 		case FS_FAT32 :
-			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
-			val = ld_dword(fs->win + clst * 4 % SS(fs)) & 0x0FFFFFFF;	/* Simple DWORD array but mask out upper 4 bits */
+			if ((p = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 4)), 0)) == 0) break;
+			val = ld_dword(p + clst * 4 % SS(fs)) & 0x0FFFFFFF;	/* Simple DWORD array but mask out upper 4 bits */
 			break;
 #if FF_FS_EXFAT
 		case FS_EXFAT :
@@ -1181,8 +1356,8 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 					if (obj->n_frag != 0) {	/* Is it on the growing edge? */
 						val = 0x7FFFFFFF;	/* Generate EOC */
 					} else {
-						if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
-						val = ld_dword(fs->win + clst * 4 % SS(fs)) & 0x7FFFFFFF;
+						if ((p = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 4)), 0)) == 0) break;
+						val = ld_dword(p + clst * 4 % SS(fs)) & 0x7FFFFFFF;
 					}
 					break;
 				}
@@ -1218,39 +1393,38 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
+#if FF_FAT_FREEMAP
+		if (val == 0) set_freemap(fs, clst, 0);	/* The region has a free cluster now */
+#endif
+		res = FR_DISK_ERR;
 		switch (fs->fs_type) {
 		case FS_FAT12:
 			bc = (UINT)clst; bc += bc / 2;	/* bc: byte offset of the entry */
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
-			if (res != FR_OK) break;
-			p = fs->win + bc++ % SS(fs);
+			if ((p = fat_sector(fs, fs->fatbase + (bc / SS(fs)), 1)) == 0) break;
+			p += bc++ % SS(fs);
 			*p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;	/* Update 1st byte */
-			fs->wflag = 1;
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
-			if (res != FR_OK) break;
-			p = fs->win + bc % SS(fs);
+			if ((p = fat_sector(fs, fs->fatbase + (bc / SS(fs)), 1)) == 0) break;
+			p += bc % SS(fs);
 			*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));	/* Update 2nd byte */
-			fs->wflag = 1;
+			res = FR_OK;
 			break;
 
 		case FS_FAT16:
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
-			if (res != FR_OK) break;
-			st_word(fs->win + clst * 2 % SS(fs), (WORD)val);	/* Simple WORD array */
-			fs->wflag = 1;
+			if ((p = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 2)), 1)) == 0) break;
+			st_word(p + clst * 2 % SS(fs), (WORD)val);	/* Simple WORD array */
+			res = FR_OK;
 			break;
 
 		case FS_FAT32:
 #if FF_FS_EXFAT
 		case FS_EXFAT:
 #endif
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
-			if (res != FR_OK) break;
+			if ((p = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 4)), 1)) == 0) break;
 			if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
-				val = (val & 0x0FFFFFFF) | (ld_dword(fs->win + clst * 4 % SS(fs)) & 0xF0000000);
+				val = (val & 0x0FFFFFFF) | (ld_dword(p + clst * 4 % SS(fs)) & 0xF0000000);
 			}
-			st_dword(fs->win + clst * 4 % SS(fs), val);
-			fs->wflag = 1;
+			st_dword(p + clst * 4 % SS(fs), val);
+			res = FR_OK;
 			break;
 		}
 	}
@@ -1499,6 +1673,9 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	DWORD cs, ncl, scl;
 	FRESULT res;
 	FATFS *fs = obj->fs;
+#if FF_FAT_FREEMAP
+	int full;
+#endif
 
 
 	if (clst == 0) {	/* Create a new chain */
@@ -1555,15 +1732,30 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 		}
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
 			ncl = scl;	/* Start cluster */
+#if FF_FAT_FREEMAP
+			full = 0;
+#endif
 			for (;;) {
 				ncl++;							/* Next cluster */
 				if (ncl >= fs->n_fatent) {		/* Check wrap-around */
 					ncl = 2;
 					if (ncl > scl) return 0;	/* No free cluster found? */
 				}
+#if FF_FAT_FREEMAP
+				if (ncl == 2 || (ncl & (((DWORD)1 << fs->fmshift) - 1)) == 0) {	/* Top of a region? */
+					if (chk_freemap(fs, ncl) && (ncl ^ scl) >> fs->fmshift) {	/* Skip it if it is known to be full and the scan does not end in it */
+						ncl = end_freemap(fs, ncl);
+						continue;
+					}
+					full = 1;
+				}
+#endif
 				cs = get_fat(obj, ncl);			/* Get the cluster status */
 				if (cs == 0) break;				/* Found a free cluster? */
 				if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+#if FF_FAT_FREEMAP
+				if (full && ncl == end_freemap(fs, ncl)) set_freemap(fs, ncl, 1);	/* Whole region scanned with no free cluster */
+#endif
 				if (ncl == scl) return 0;		/* No free cluster found? */
 			}
 		}
@@ -1590,6 +1782,23 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 
 
 #if FF_USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Get the link map table of a file                       */
+/*-----------------------------------------------------------------------*/
+
+static DWORD* get_cltbl (	/* 0:Normal seek mode, others:Pointer to the CLMT */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	FILX *fx = ff_filext(fp);
+
+
+	return fx ? fx->cltbl : 0;	/* Files without an extension have no CLMT */
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Convert offset into cluster with link map table        */
 /*-----------------------------------------------------------------------*/
@@ -1603,7 +1812,7 @@ static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	FATFS *fs = fp->obj.fs;
 
 
-	tbl = fp->cltbl + 1;	/* Top of CLMT */
+	tbl = CLTBL(fp) + 1;	/* Top of CLMT */
 	cl = (DWORD)(ofs / SS(fs) / fs->csize);	/* Cluster order from top of the file */
 	for (;;) {
 		ncl = *tbl++;			/* Number of cluters in the fragment */
@@ -2346,6 +2555,148 @@ static FRESULT dir_read (
 
 
 
+#if FF_DIR_WATCH && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Watched directories (Agon)                                            */
+/*-----------------------------------------------------------------------*/
+
+static void dir_changed (
+	FATFS* fs,		/* Filesystem object */
+	DWORD dclst		/* Start cluster of the directory with an entry added or removed */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fs->dwcount && i < FF_DIR_WATCH; i++) {
+		if (fs->dwclust[i] == dclst) {
+			fs->dirmod++;
+			break;
+		}
+	}
+}
+#define DIR_CHANGED(fs, dclst)	dir_changed(fs, dclst)
+#define DIRS_CHANGED(fs)		((fs)->dirmod++)	/* A directory was created, renamed or removed */
+#else
+#define DIR_CHANGED(fs, dclst)
+#define DIRS_CHANGED(fs)
+#endif
+
+
+
+#if FF_DIR_CACHE
+/*-----------------------------------------------------------------------*/
+/* Path lookup cache (Agon)                                              */
+/*-----------------------------------------------------------------------*/
+/* The location of the entry found by each dir_find() in follow_path() is
+/  remembered, keyed by the directory and the segment name. Attributes, size
+/  and first cluster are read from the entry itself on a hit, so only adding
+/  or removing a directory entry needs the cache to be cleared. */
+
+static void clear_dcache (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_DIR_CACHE; i++) fs->dcache[i].name[0] = 0;
+}
+
+
+static int cmp_dcache (	/* 1:The entry is for the name in dp, 0:Not */
+	const DCENT* dc,	/* Cache entry */
+	DIR* dp				/* Directory object with the segment name */
+)
+{
+#if FF_USE_LFN
+	const WCHAR *lfn = dp->obj.fs->lfnbuf;
+	UINT i;
+
+
+	for (i = 0; i < FF_DIR_CACHE_NAME && dc->name[i] == lfn[i]; i++) {
+		if (lfn[i] == 0) return 1;
+	}
+	return 0;
+#else
+	return !memcmp(dc->name, dp->fn, 11);
+#endif
+}
+
+
+static int get_dcache (	/* 1:Result taken from the cache, 0:Not cached */
+	DIR* dp,			/* Directory object with the segment name */
+	FRESULT* res		/* Result of the lookup */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	DCENT *dc;
+	UINT i;
+
+
+	if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) return 0;
+	for (i = 0, dc = fs->dcache; i < FF_DIR_CACHE; i++, dc++) {
+		if (dc->name[0] != 0 && dc->dclust == dp->obj.sclust && cmp_dcache(dc, dp)) break;
+	}
+	if (i == FF_DIR_CACHE) {
+		fs->dcmiss++;
+		return 0;
+	}
+	fs->dchit++;
+	if (dc->dptr == 0xFFFFFFFF) {	/* Known not to exist */
+		*res = dir_sdi(dp, 0);
+		if (*res == FR_OK) *res = FR_NO_FILE;
+		return 1;
+	}
+	dp->dptr = dc->dptr;			/* Restore the state dir_find() left */
+	dp->clust = dc->clust;
+	dp->sect = dc->sect;
+#if FF_USE_LFN
+	dp->blk_ofs = dc->blk_ofs;
+#endif
+	*res = move_window(fs, dp->sect);
+	if (*res == FR_OK) {
+		dp->dir = fs->win + dp->dptr % SS(fs);
+		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+	}
+	return 1;
+}
+
+
+static void put_dcache (
+	DIR* dp,			/* Directory object after dir_find() */
+	FRESULT res			/* Result of dir_find() */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	DCENT *dc;
+#if FF_USE_LFN
+	UINT i;
+
+
+	for (i = 0; fs->lfnbuf[i]; i++) {
+		if (i == FF_DIR_CACHE_NAME - 1) return;	/* Too long to cache */
+	}
+#endif
+	if ((res != FR_OK && res != FR_NO_FILE) || (FF_FS_EXFAT && fs->fs_type == FS_EXFAT)) return;
+	dc = &fs->dcache[fs->dcnext];
+	fs->dcnext = (BYTE)((fs->dcnext + 1) % FF_DIR_CACHE);
+	dc->dclust = dp->obj.sclust;
+	dc->dptr = (res == FR_OK) ? dp->dptr : 0xFFFFFFFF;
+	dc->clust = dp->clust;
+	dc->sect = dp->sect;
+#if FF_USE_LFN
+	dc->blk_ofs = dp->blk_ofs;
+	memcpy(dc->name, fs->lfnbuf, (i + 1) * sizeof (WCHAR));
+#else
+	memcpy(dc->name, dp->fn, 11);
+#endif
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
@@ -2524,6 +2875,10 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			fs->wflag = 1;
 		}
 	}
+	DIR_CHANGED(fs, dp->obj.sclust);
+#if FF_DIR_CACHE
+	clear_dcache(fs);	/* Names not found before may exist now */
+#endif
 
 	return res;
 }
@@ -2570,6 +2925,10 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		fs->wflag = 1;
 	}
 #endif
+	DIR_CHANGED(fs, dp->obj.sclust);
+#if FF_DIR_CACHE
+	clear_dcache(fs);	/* The entry is gone */
+#endif
 
 	return res;
 }
@@ -3044,7 +3403,15 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		for (;;) {
 			res = create_name(dp, &path);	/* Get a segment name of the path */
 			if (res != FR_OK) break;
-			res = dir_find(dp);				/* Find an object with the segment name */
+#if FF_DIR_CACHE
+			if (!get_dcache(dp, &res))		/* Look the segment name up in the cache first */
+#endif
+			{
+				res = dir_find(dp);			/* Find an object with the segment name */
+#if FF_DIR_CACHE
+				put_dcache(dp, res);
+#endif
+			}
 			ns = dp->fn[NSFLAG];
 			if (res != FR_OK) {				/* Failed to find the object */
 				if (res == FR_NO_FILE) {	/* Object is not found */
@@ -3342,6 +3709,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	WORD nrsv;
 	FATFS *fs;
 	UINT fmt;
+#if FF_FAT_CACHE
+	UINT i;
+#endif
 
 
 	/* Get logical drive number */
@@ -3534,6 +3904,20 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #endif	/* !FF_FS_READONLY */
 	}
 
+#if FF_FAT_FREEMAP
+	for (fs->fmshift = 7; (fs->n_fatent - 1) >> fs->fmshift >= FF_FAT_FREEMAP * 8; fs->fmshift++) ;	/* At least one FAT sector per bit */
+	memset(fs->fmap, 0, FF_FAT_FREEMAP);	/* Nothing is known to be full yet */
+#endif
+#if FF_DIR_CACHE
+	clear_dcache(fs);
+#endif
+#if FF_FAT_CACHE
+	if (!fs->fcbuf) fs->fcbuf = ff_memalloc(FF_FAT_CACHE * SS(fs));	/* Allocate the FAT cache on the first mount */
+	for (i = 0; i < FF_FAT_CACHE; i++) {
+		fs->fcsect[i] = (LBA_t)0 - 1;	/* Invalidate the FAT cache */
+		fs->fcflag[i] = 0;
+	}
+#endif
 	fs->fs_type = (BYTE)fmt;/* FAT sub-type */
 	fs->id = ++Fsid;		/* Volume mount ID */
 #if FF_USE_LFN == 1
@@ -3620,6 +4004,9 @@ FRESULT f_mount (
 	cfs = FatFs[vol];					/* Pointer to fs object */
 
 	if (cfs) {
+#if !FF_FS_READONLY
+		if (!fs && cfs->fs_type) sync_fs(cfs);	/* Unmounting: write back the window and the disk cache while the medium is still there (Agon) */
+#endif
 #if FF_FS_LOCK != 0
 		clear_lock(cfs);
 #endif
@@ -3646,6 +4033,34 @@ FRESULT f_mount (
 
 
 
+#if FF_FILX
+/*-----------------------------------------------------------------------*/
+/* Release the heap memory held by the extension of a file object        */
+/*-----------------------------------------------------------------------*/
+
+static void release_filext (
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	FILX *fx = ff_filext(fp);
+
+
+	if (fx) {
+#if FF_USE_FASTSEEK
+		ff_memfree(fx->cltbl);	/* Back to normal seek mode */
+		fx->cltbl = 0;
+#endif
+#if FF_FS_TINY
+		ff_memfree(fx->buf);	/* Back to the shared window */
+		fx->buf = 0;
+#endif
+	}
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Open or Create a File                                                 */
 /*-----------------------------------------------------------------------*/
@@ -3668,6 +4083,9 @@ FRESULT f_open (
 
 
 	if (!fp) return FR_INVALID_OBJECT;
+#if FF_FILX
+	release_filext(fp);	/* Whatever the file object held before is gone */
+#endif
 
 	/* Get logical drive number */
 	mode &= FF_FS_READONLY ? FA_READ : FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS | FA_OPEN_APPEND;
@@ -3791,9 +4209,6 @@ FRESULT f_open (
 				fp->obj.sclust = ld_clust(fs, dj.dir);					/* Get object allocation info */
 				fp->obj.objsize = ld_dword(dj.dir + DIR_FileSize);
 			}
-#if FF_USE_FASTSEEK
-			fp->cltbl = 0;		/* Disable fast seek mode */
-#endif
 			fp->obj.fs = fs;	/* Validate the file object */
 			fp->obj.id = fs->id;
 			fp->flag = mode;	/* Set file access mode */
@@ -3820,9 +4235,7 @@ FRESULT f_open (
 						res = FR_INT_ERR;
 					} else {
 						fp->sect = sc + (DWORD)(ofs / SS(fs));
-#if !FF_FS_TINY
-						if (disk_read(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) res = FR_DISK_ERR;
-#endif
+						if (!SHARED_WIN(fp) && disk_read(fs->pdrv, FBUF(fp), fp->sect, 1) != RES_OK) res = FR_DISK_ERR;
 					}
 				}
 #if FF_FS_LOCK != 0
@@ -3859,7 +4272,8 @@ FRESULT f_read (
 	DWORD clst;
 	LBA_t sect;
 	FSIZE_t remain;
-	UINT rcnt, cc, csect;
+	UINT rcnt, cc, csect, rem;
+	DWORD ncl;
 	BYTE *rbuff = (BYTE*)buff;
 
 
@@ -3878,7 +4292,7 @@ FRESULT f_read (
 					clst = fp->obj.sclust;		/* Follow cluster chain from the origin */
 				} else {						/* Middle or end of the file */
 #if FF_USE_FASTSEEK
-					if (fp->cltbl) {
+					if (CLTBL(fp)) {
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					} else
 #endif
@@ -3897,43 +4311,44 @@ FRESULT f_read (
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
+					while ((rem = btr / SS(fs) - cc) > 0) {	/* Extend it over the following clusters while the chain is contiguous */
+						ncl = get_fat(&fp->obj, fp->clust);
+						if (ncl != fp->clust + 1) break;	/* Not contiguous, end of chain or error: leave it to the next cluster boundary */
+						fp->clust = ncl;
+						cc += (rem < fs->csize) ? rem : fs->csize;
+					}
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
-#if FF_FS_TINY
-				if (fs->wflag && fs->winsect - sect < cc) {
-					memcpy(rbuff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
-				}
-#else
-				if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
-					memcpy(rbuff + ((fp->sect - sect) * SS(fs)), fp->buf, SS(fs));
+				if (SHARED_WIN(fp)) {
+					if (fs->wflag && fs->winsect - sect < cc) {
+						memcpy(rbuff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
+					}
+				} else {
+					if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
+						memcpy(rbuff + ((fp->sect - sect) * SS(fs)), FBUF(fp), SS(fs));
+					}
 				}
-#endif
 #endif
 				rcnt = SS(fs) * cc;				/* Number of bytes transferred */
 				continue;
 			}
-#if !FF_FS_TINY
-			if (fp->sect != sect) {			/* Load data sector if not in cache */
+			if (!SHARED_WIN(fp) && fp->sect != sect) {	/* Load data sector if not in cache */
 #if !FF_FS_READONLY
-				if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-					fp->flag &= (BYTE)~FA_DIRTY;
-				}
+				if (flush_buf(fs, fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back dirty sector cache */
 #endif
-				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK)	ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+				if (disk_read(fs->pdrv, FBUF(fp), sect, 1) != RES_OK)	ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
 			}
-#endif
 			fp->sect = sect;
 		}
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
-#if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
-		memcpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
-#else
-		memcpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
-#endif
+		if (SHARED_WIN(fp)) {
+			if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+			memcpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+		} else {
+			memcpy(rbuff, FBUF(fp) + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+		}
 	}
 
 	LEAVE_FF(fs, FR_OK);
@@ -3958,7 +4373,8 @@ FRESULT f_write (
 	FATFS *fs;
 	DWORD clst;
 	LBA_t sect;
-	UINT wcnt, cc, csect;
+	UINT wcnt, cc, csect, rem;
+	DWORD ncl;
 	const BYTE *wbuff = (const BYTE*)buff;
 
 
@@ -3983,7 +4399,7 @@ FRESULT f_write (
 					}
 				} else {					/* On the middle or end of the file */
 #if FF_USE_FASTSEEK
-					if (fp->cltbl) {
+					if (CLTBL(fp)) {
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					} else
 #endif
@@ -3997,14 +4413,11 @@ FRESULT f_write (
 				fp->clust = clst;			/* Update current cluster */
 				if (fp->obj.sclust == 0) fp->obj.sclust = clst;	/* Set start cluster if the first write */
 			}
-#if FF_FS_TINY
-			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
-#else
-			if (fp->flag & FA_DIRTY) {		/* Write-back sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+			if (SHARED_WIN(fp)) {
+				if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
+			} else {
+				if (flush_buf(fs, fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
 			}
-#endif
 			sect = clst2sect(fs, fp->clust);	/* Get current sector */
 			if (sect == 0) ABORT(fs, FR_INT_ERR);
 			sect += csect;
@@ -4012,6 +4425,12 @@ FRESULT f_write (
 			if (cc > 0) {					/* Write maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
+					while ((rem = btw / SS(fs) - cc) > 0) {	/* Extend it over the following clusters while the chain is contiguous (e.g. after f_expand) */
+						ncl = get_fat(&fp->obj, fp->clust);
+						if (ncl != fp->clust + 1) break;	/* Not contiguous, end of chain or error: leave it to the next cluster boundary */
+						fp->clust = ncl;
+						cc += (rem < fs->csize) ? rem : fs->csize;
+					}
 				}
 				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if FF_FS_MINIMIZE <= 2
@@ -4020,40 +4439,39 @@ FRESULT f_write (
 					memcpy(fs->win, wbuff + ((fs->winsect - sect) * SS(fs)), SS(fs));
 					fs->wflag = 0;
 				}
-#else
-				if (fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
-					memcpy(fp->buf, wbuff + ((fp->sect - sect) * SS(fs)), SS(fs));
+#endif
+				if (!SHARED_WIN(fp) && fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
+					memcpy(FBUF(fp), wbuff + ((fp->sect - sect) * SS(fs)), SS(fs));
 					fp->flag &= (BYTE)~FA_DIRTY;
 				}
-#endif
 #endif
 				wcnt = SS(fs) * cc;		/* Number of bytes transferred */
 				continue;
 			}
-#if FF_FS_TINY
-			if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
-				if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
-				fs->winsect = sect;
-			}
-#else
-			if (fp->sect != sect && 		/* Fill sector cache with file data */
-				fp->fptr < fp->obj.objsize &&
-				disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) {
-					ABORT(fs, FR_DISK_ERR);
+			if (SHARED_WIN(fp)) {
+				if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
+					if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+					fs->winsect = sect;
+				}
+			} else {
+				if (fp->sect != sect && 		/* Fill sector cache with file data */
+					fp->fptr < fp->obj.objsize &&
+					disk_read(fs->pdrv, FBUF(fp), sect, 1) != RES_OK) {
+						ABORT(fs, FR_DISK_ERR);
+				}
 			}
-#endif
 			fp->sect = sect;
 		}
 		wcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (wcnt > btw) wcnt = btw;					/* Clip it by btw if needed */
-#if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
-		memcpy(fs->win + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
-		fs->wflag = 1;
-#else
-		memcpy(fp->buf + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
-		fp->flag |= FA_DIRTY;
-#endif
+		if (SHARED_WIN(fp)) {
+			if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+			memcpy(fs->win + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
+			fs->wflag = 1;
+		} else {
+			memcpy(FBUF(fp) + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
+			fp->flag |= FA_DIRTY;
+		}
 	}
 
 	fp->flag |= FA_MODIFIED;				/* Set file change flag */
@@ -4081,12 +4499,7 @@ FRESULT f_sync (
 	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
 	if (res == FR_OK) {
 		if (fp->flag & FA_MODIFIED) {	/* Is there any change to the file? */
-#if !FF_FS_TINY
-			if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) LEAVE_FF(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
-#endif
+			if (!SHARED_WIN(fp) && flush_buf(fs, fp) != FR_OK) LEAVE_FF(fs, FR_DISK_ERR);	/* Write-back cached data if needed */
 			/* Update the directory entry */
 			tm = GET_FATTIME();				/* Modified time */
 #if FF_FS_EXFAT
@@ -4169,6 +4582,9 @@ FRESULT f_close (
 #else
 			fp->obj.fs = 0;	/* Invalidate file object */
 #endif
+#if FF_FILX
+			if (res == FR_OK) release_filext(fp);	/* Free the CLMT and private buffer */
+#endif
 #if FF_FS_REENTRANT
 			unlock_fs(fs, FR_OK);		/* Unlock volume */
 #endif
@@ -4180,6 +4596,47 @@ FRESULT f_close (
 
 
 
+#if FF_FS_TINY
+/*-----------------------------------------------------------------------*/
+/* Set a Private Sector Buffer for a File                                */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_setbuf (
+	FIL* fp,		/* Pointer to the file object */
+	BYTE* buf		/* Sector buffer of FF_MAX_SS bytes from ff_memalloc(), freed by FatFs (0:Go back to the shared window) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FILX *fx;
+
+
+	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
+	if (res == FR_OK) res = (FRESULT)fp->err;
+	fx = ff_filext(fp);
+	if (res == FR_OK && !fx) res = FR_INVALID_PARAMETER;	/* Only a file with an extension can have a private buffer */
+	if (res == FR_OK) {
+#if !FF_FS_READONLY
+		if (fx->buf) {				/* Write-back the current buffer */
+			if (flush_buf(fs, fp) != FR_OK) ABORT(fs, FR_DISK_ERR);
+		}
+		if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* File data in the window must not be written back over the buffer */
+#endif
+		if (buf && fp->sect != 0) {	/* Load the current sector into the new buffer */
+			if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);
+			memcpy(buf, fs->win, SS(fs));
+		}
+		if (fx->buf != buf) ff_memfree(fx->buf);	/* Release the buffer being replaced */
+		fx->buf = buf;
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+
 #if FF_FS_RPATH >= 1
 /*-----------------------------------------------------------------------*/
 /* Change Current Directory or Current Drive, Get Current Directory      */
@@ -4390,9 +4847,9 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fs, res);
 
 #if FF_USE_FASTSEEK
-	if (fp->cltbl) {	/* Fast seek */
+	if (CLTBL(fp)) {	/* Fast seek */
 		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
-			tbl = fp->cltbl;
+			tbl = CLTBL(fp);
 			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
 			cl = fp->obj.sclust;		/* Origin of the chain */
 			if (cl != 0) {
@@ -4410,7 +4867,7 @@ FRESULT f_lseek (
 					}
 				} while (cl < fs->n_fatent);	/* Repeat until end of chain */
 			}
-			*fp->cltbl = ulen;	/* Number of items used */
+			*CLTBL(fp) = ulen;	/* Number of items used */
 			if (ulen <= tlen) {
 				*tbl = 0;		/* Terminate table */
 			} else {
@@ -4425,15 +4882,12 @@ FRESULT f_lseek (
 				if (dsc == 0) ABORT(fs, FR_INT_ERR);
 				dsc += (DWORD)((ofs - 1) / SS(fs)) & (fs->csize - 1);
 				if (fp->fptr % SS(fs) && dsc != fp->sect) {	/* Refill sector cache if needed */
-#if !FF_FS_TINY
+					if (!SHARED_WIN(fp)) {
 #if !FF_FS_READONLY
-					if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-						if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-						fp->flag &= (BYTE)~FA_DIRTY;
-					}
-#endif
-					if (disk_read(fs->pdrv, fp->buf, dsc, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Load current sector */
+						if (flush_buf(fs, fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back dirty sector cache */
 #endif
+						if (disk_read(fs->pdrv, FBUF(fp), dsc, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Load current sector */
+					}
 					fp->sect = dsc;
 				}
 			}
@@ -4505,15 +4959,12 @@ FRESULT f_lseek (
 			fp->flag |= FA_MODIFIED;
 		}
 		if (fp->fptr % SS(fs) && nsect != fp->sect) {	/* Fill sector cache if needed */
-#if !FF_FS_TINY
+			if (!SHARED_WIN(fp)) {
 #if !FF_FS_READONLY
-			if (fp->flag & FA_DIRTY) {			/* Write-back dirty sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
-#endif
-			if (disk_read(fs->pdrv, fp->buf, nsect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+				if (flush_buf(fs, fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back dirty sector cache */
 #endif
+				if (disk_read(fs->pdrv, FBUF(fp), nsect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+			}
 			fp->sect = nsect;
 		}
 	}
@@ -4758,7 +5209,11 @@ FRESULT f_getfree (
 	DWORD nfree, clst, stat;
 	LBA_t sect;
 	UINT i;
+	BYTE *fat;
 	FFOBJID obj;
+#if FF_FAT_FREEMAP && !FF_FS_READONLY
+	int full = 1;
+#endif
 
 
 	/* Get logical drive */
@@ -4807,17 +5262,25 @@ FRESULT f_getfree (
 					i = 0;					/* Offset in the sector */
 					do {	/* Counts numbuer of entries with zero in the FAT */
 						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
+							if ((fat = fat_sector(fs, sect++, 0)) == 0) {
+								res = FR_DISK_ERR;
+								break;
+							}
 						}
 						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;
+							stat = ld_word(fat + i);
 							i += 2;
 						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
+							stat = ld_dword(fat + i) & 0x0FFFFFFF;
 							i += 4;
 						}
 						i %= SS(fs);
+						if (stat == 0) nfree++;
+#if FF_FAT_FREEMAP && !FF_FS_READONLY
+						if (((fs->n_fatent - clst) & (((DWORD)1 << fs->fmshift) - 1)) == 0) full = 1;	/* Top of a region */
+						if (stat == 0) full = 0;
+						if (fs->n_fatent - clst == end_freemap(fs, fs->n_fatent - clst)) set_freemap(fs, fs->n_fatent - clst, full);
+#endif
 					} while (--clst);
 				}
 			}
@@ -4867,15 +5330,9 @@ FRESULT f_truncate (
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current read/write point */
 		fp->flag |= FA_MODIFIED;
-#if !FF_FS_TINY
-		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
-			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) {
-				res = FR_DISK_ERR;
-			} else {
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
+		if (res == FR_OK && !SHARED_WIN(fp)) {
+			res = flush_buf(fs, fp);
 		}
-#endif
 		if (res != FR_OK) ABORT(fs, res);
 	}
 
@@ -4960,6 +5417,7 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+				if (dj.obj.attr & AM_DIR) DIRS_CHANGED(fs);
 				if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
 #if FF_FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
@@ -5027,6 +5485,7 @@ FRESULT f_mkdir (
 						fs->wflag = 1;
 					}
 					res = dir_register(&dj);	/* Register the object to the parent directoy */
+					DIRS_CHANGED(fs);
 				}
 			}
 			if (res == FR_OK) {
@@ -5113,6 +5572,7 @@ FRESULT f_rename (
 						fs->dirbuf[XDIR_NumSec] = nf; fs->dirbuf[XDIR_NumName] = nn;
 						st_word(fs->dirbuf + XDIR_NameHash, nh);
 						if (!(fs->dirbuf[XDIR_Attr] & AM_DIR)) fs->dirbuf[XDIR_Attr] |= AM_ARC;	/* Set archive attribute if it is a file */
+						else DIRS_CHANGED(fs);
 /* Start of critical section where an interruption can cause a cross-link */
 						res = store_xdir(&djn);
 					}
@@ -5133,6 +5593,7 @@ FRESULT f_rename (
 						memcpy(dir + 13, buf + 13, SZDIRE - 13);
 						dir[DIR_Attr] = buf[DIR_Attr];
 						if (!(dir[DIR_Attr] & AM_DIR)) dir[DIR_Attr] |= AM_ARC;	/* Set archive attribute if it is a file */
+						else DIRS_CHANGED(fs);
 						fs->wflag = 1;
 						if ((dir[DIR_Attr] & AM_DIR) && djo.obj.sclust != djn.obj.sclust) {	/* Update .. entry in the sub-directory if needed */
 							sect = clst2sect(fs, ld_clust(fs, dir));
@@ -5616,21 +6077,18 @@ FRESULT f_forward (
 		sect = clst2sect(fs, fp->clust);			/* Get current data sector */
 		if (sect == 0) ABORT(fs, FR_INT_ERR);
 		sect += csect;
-#if FF_FS_TINY
-		if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
-		dbuf = fs->win;
-#else
-		if (fp->sect != sect) {		/* Fill sector cache with file data */
+		if (SHARED_WIN(fp)) {
+			if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
+			dbuf = fs->win;
+		} else {
+			if (fp->sect != sect) {		/* Fill sector cache with file data */
 #if !FF_FS_READONLY
-			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
+				if (flush_buf(fs, fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back dirty sector cache */
 #endif
-			if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				if (disk_read(fs->pdrv, FBUF(fp), sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+			}
+			dbuf = FBUF(fp);
 		}
-		dbuf = fp->buf;
-#endif
 		fp->sect = sect;
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (rcnt > btf) rcnt = btf;					/* Clip it by btr if needed */
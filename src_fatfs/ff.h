@@ -130,6 +130,25 @@ extern const char* VolumeStr[FF_VOLUMES];	/* User defied volume ID */
 
 
 
+#if FF_DIR_CACHE
+/* Path lookup cache entry (Agon) */
+
+typedef struct {
+	DWORD	dclust;			/* Start cluster of the directory searched (0:Root directory) */
+	DWORD	dptr;			/* Offset of the entry in the directory (0xFFFFFFFF:Name not found) */
+	DWORD	clust;			/* Cluster holding the entry */
+	LBA_t	sect;			/* Sector holding the entry */
+#if FF_USE_LFN
+	DWORD	blk_ofs;		/* Offset of the LFN entry block (0xFFFFFFFF:No LFN) */
+	WCHAR	name[FF_DIR_CACHE_NAME];	/* Segment name (name[0] == 0:Empty slot) */
+#else
+	BYTE	name[11];		/* Segment name in SFN format (name[0] == 0:Empty slot) */
+#endif
+} DCENT;
+#endif
+
+
+
 /* Filesystem object structure (FATFS) */
 
 typedef struct {
@@ -176,6 +195,30 @@ typedef struct {
 #endif
 	LBA_t	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
+#if FF_FAT_CACHE
+	BYTE*	fcbuf;			/* FAT sector cache of FF_FAT_CACHE sectors (0:Not allocated, FAT goes through win[]) */
+	LBA_t	fcsect[FF_FAT_CACHE];	/* Sector in each cache slot */
+	BYTE	fcflag[FF_FAT_CACHE];	/* Cache slot flags (b0:dirty) */
+	WORD	fcuse[FF_FAT_CACHE];	/* Cache slot last use, for LRU replacement */
+	WORD	fcclock;		/* LRU clock */
+	DWORD	fchit;			/* Number of FAT cache hits */
+	DWORD	fcmiss;			/* Number of FAT cache misses */
+#endif
+#if FF_FAT_FREEMAP
+	BYTE	fmshift;		/* Clusters per freemap bit (log2) */
+	BYTE	fmap[FF_FAT_FREEMAP];	/* Freemap (1:Region known to have no free cluster) */
+#endif
+#if FF_DIR_WATCH
+	DWORD	dwclust[FF_DIR_WATCH];	/* Start clusters of the watched directories (Agon) */
+	BYTE	dwcount;		/* Number of watched directories */
+	WORD	dirmod;			/* Number of changes to the watched directories */
+#endif
+#if FF_DIR_CACHE
+	DCENT	dcache[FF_DIR_CACHE];	/* Path lookup cache */
+	BYTE	dcnext;			/* Next path lookup cache slot to replace */
+	DWORD	dchit;			/* Number of path lookup cache hits */
+	DWORD	dcmiss;			/* Number of path lookup cache misses */
+#endif
 } FATFS;
 
 
@@ -216,9 +259,6 @@ typedef struct {
 	LBA_t	dir_sect;		/* Sector number containing the directory entry (not used at exFAT) */
 	BYTE*	dir_ptr;		/* Pointer to the directory entry in the win[] (not used at exFAT) */
 #endif
-#if FF_USE_FASTSEEK
-	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
-#endif
 #if !FF_FS_TINY
 	BYTE	buf[FF_MAX_SS];	/* File private data read/write window */
 #endif
@@ -226,6 +266,25 @@ typedef struct {
 
 
 
+#define FF_FILX	(FF_USE_FASTSEEK || FF_FS_TINY)
+#if FF_FILX
+/* File object extension (Agon)
+/  Kept by the application outside FIL, so that the FIL layout seen by programs
+/  using the MOS API doesn't change. ff_filext() finds it for a file object.
+/  The memory it points to comes from ff_memalloc(); f_open and f_close free it. */
+
+typedef struct {
+#if FF_USE_FASTSEEK
+	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
+#endif
+#if FF_FS_TINY
+	BYTE*	buf;			/* File private data read/write window (nulled on open, set by f_setbuf) */
+#endif
+} FILX;
+#endif
+
+
+
 /* Directory object structure (DIR) */
 
 typedef struct {
@@ -313,6 +372,7 @@ FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data t
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate the file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of the writing file */
+FRESULT f_setbuf (FIL* fp, BYTE* buf);								/* Set a private sector buffer for a file (FF_FS_TINY) */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
@@ -361,13 +421,18 @@ TCHAR* f_gets (TCHAR* buff, int len, FIL* fp);						/* Get a string from the fil
 DWORD get_fattime (void);
 #endif
 
+/* File object extension (Agon) */
+#if FF_FILX
+FILX* ff_filext (FIL* fp);				/* Extension of a file object (null if it has none) */
+#endif
+
 /* LFN support functions */
 #if FF_USE_LFN >= 1						/* Code conversion (defined in unicode.c) */
 WCHAR ff_oem2uni (WCHAR oem, WORD cp);	/* OEM code to Unicode conversion */
 WCHAR ff_uni2oem (DWORD uni, WORD cp);	/* Unicode to OEM code conversion */
 DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 #endif
-#if FF_USE_LFN == 3						/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_FAT_CACHE || FF_FILX	/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);			/* Allocate memory block */
 void ff_memfree (void* mblock);			/* Free memory block */
 #endif
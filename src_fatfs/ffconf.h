@@ -2,7 +2,7 @@
  * Title:			FatFs Functional Configuration
  * Author:			ChaN
  * Created:			19/06/2022
- * Last Updated:	13/04/2023
+ * Last Updated:	16/10/2026
  * 
  * Modinfo:
  * 11/07/2022:		Enabled FF_USE_LABEL
@@ -10,6 +10,15 @@
  * 15/02/2023:		FF_USE_STRFUNC set to 1
  * 09/03/2023:		FF_FS_NORTC set to 0
  * 13/04/2023:		FF_FS_TINY set to 1
+ * 16/10/2026:		FF_USE_TRIM set to 1
+ *					FF_USE_FASTSEEK set to 1
+ *					In tiny configuration, f_setbuf can give a file a private sector buffer
+ *					FF_USE_EXPAND set to 1
+ *					Added FF_FAT_CACHE
+ *					Added FF_FAT_FREEMAP
+ *					Added FF_DIR_CACHE, FF_DIR_CACHE_NAME
+ *					Added FF_DIR_WATCH
+ *					FF_USE_FORWARD set to 1
  */
  
 /*---------------------------------------------------------------------------/
@@ -48,11 +57,11 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -66,7 +75,7 @@
 /  (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FORWARD	0
+#define FF_USE_FORWARD	1
 /* This option switches f_forward() function. (0:Disable or 1:Enable) */
 
 
@@ -227,7 +236,7 @@
 /  f_fdisk function. 0x100000000 max. This option has no effect when FF_LBA64 == 0. */
 
 
-#define FF_USE_TRIM		0
+#define FF_USE_TRIM		1
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
 /  disk_ioctl() function. */
@@ -242,7 +251,39 @@
 /* This option switches tiny buffer configuration. (0:Normal or 1:Tiny)
 /  At the tiny configuration, size of file object (FIL) is shrinked FF_MAX_SS bytes.
 /  Instead of private sector buffer eliminated from the file object, common sector
-/  buffer in the filesystem object (FATFS) is used for the file data transfer. */
+/  buffer in the filesystem object (FATFS) is used for the file data transfer.
+/  A file can still be given a private sector buffer with f_setbuf() (Agon). */
+
+
+#define FF_FAT_CACHE	2
+/* This option sets the number of FAT sectors cached apart from the window in
+/  the filesystem object (Agon). (0:Disable or 1-255) The cache is allocated
+/  with ff_memalloc() when the volume is mounted; if that fails the FAT goes
+/  through the window as before. */
+
+
+#define FF_FAT_FREEMAP	128
+/* This option sets the size in bytes of a map kept in the filesystem object of
+/  which regions of the FAT are known to have no free clusters (Agon). Each bit
+/  covers one or more FAT sectors, and create_chain() skips the regions marked
+/  full instead of reading them. (0:Disable) */
+
+
+#define FF_DIR_CACHE		8
+#define FF_DIR_CACHE_NAME	24
+/* FF_DIR_CACHE sets the number of path segment lookups remembered in the
+/  filesystem object (Agon). (0:Disable) Each entry maps a directory and a name
+/  to the location of its directory entry, or records that the name was not
+/  found. FF_DIR_CACHE_NAME is the longest name cached, including terminator.
+/  The cache is cleared whenever a directory entry is added or removed. */
+
+
+#define FF_DIR_WATCH	8
+/* This option sets the number of directories that can be watched for changes
+/  (Agon). (0:Disable) The application puts the start clusters of the
+/  directories in dwclust[] of the filesystem object, and dirmod is incremented
+/  when an entry is added to or removed from one of them, or when any
+/  directory is created, renamed or removed. */
 
 
 #define FF_FS_EXFAT		0
@@ -6,7 +6,7 @@
 #include "ff.h"
 #include "umm_malloc.h"
 
-#if FF_USE_LFN == 3	/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_FAT_CACHE || FF_FILX	/* Dynamic memory allocation */
 
 /*------------------------------------------------------------------------*/
 /* Allocate a memory block                                                */
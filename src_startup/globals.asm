@@ -2,7 +2,7 @@
 ; Title:	AGON MOS - Globals
 ; Author:	Dean Belfield
 ; Created:	01/08/2022
-; Last Updated:	11/11/2023
+; Last Updated:	16/10/2026
 ;
 ; Modinfo:
 ; 09/08/2022:	Added sysvars structure, cursorX, cursorY
@@ -21,6 +21,9 @@
 ; 03/08/2023:	Added user_kbvector
 ; 13/08/2023:	Added keymap
 ; 11/11/2023:	Added i2c
+; 16/10/2026:	Added UART0 transmit buffer
+;		Added uart0_irqCount, uart0_rxCount
+;		Added vdp_protocol_seq, vdp_shadow, vdp_txcount
 
 			INCLUDE	"../src/equs.inc"
 			
@@ -61,6 +64,11 @@
 			XDEF 	_coldBoot
 			XDEF	_gp
 			XDEF	_serialFlags
+			XDEF	_uart0_txbuf
+			XDEF	_uart0_txhead
+			XDEF	_uart0_txtail
+			XDEF	_uart0_irqCount
+			XDEF	_uart0_rxCount
 			XDEF 	_callSM
 			XDEF	_scratchpad
 			XDEF	_keymap 
@@ -71,6 +79,9 @@
 			XDEF	_vdp_protocol_len
 			XDEF	_vdp_protocol_ptr
 			XDEF	_vdp_protocol_data
+			XDEF	_vdp_protocol_seq
+			XDEF	_vdp_shadow
+			XDEF	_vdp_txcount
 
 			XDEF	_user_kbvector
 
@@ -128,11 +139,25 @@ _gp:			DS	1		; extern char _gp
 ;
 ; - Bit 0: UART0 enabled
 ; - Bit 1: UART0 hardware flow control
+; - Bit 2: UART0 transmit buffer enabled
 ; - Bit 4: UART1 enabled
 ; - Bit 5: UART1 hardware flow control
 ;
 _serialFlags:		DS	1		; extern char _serialFlags
 
+; UART0 transmit buffer
+;
+; The indexes are single bytes that wrap at 256, so the buffer must be 256 bytes
+;
+_uart0_txhead:		DS	1		; Index of the next byte to add
+_uart0_txtail:		DS	1		; Index of the next byte to send
+_uart0_txbuf:		DS	256		; The buffer
+
+; UART0 statistics (these wrap at 24 bits)
+;
+_uart0_irqCount:	DS	3		; Number of UART0 interrupts
+_uart0_rxCount:		DS	3		; Number of bytes received on UART0
+
 _callSM:		DS	5		; Self-modding code for CALL.IS (HL)
 _scratchpad:		DS	8		; General purpose scratchpad RAM for use within functions
 
@@ -159,6 +184,26 @@ _vdp_protocol_len:	DS	1		; Size of packet data
 _vdp_protocol_ptr:	DS	3		; Pointer into data
 _vdp_protocol_data:	DS	VDPP_BUFFERLEN
 
+; VDP reply sequence counters
+;
+; One byte per VDP protocol flag, incremented each time that packet is received.
+; A waiter reads its counter before sending a request, then waits for it to change
+;
+_vdp_protocol_seq:	DS	VDPP_SEQ_COUNT
+
+; Shadow VDP state
+;
+; Bit 0: cursorX, cursorY are up to date
+; Bit 1: Screen mode sysvars are up to date
+; Bit 2: Text colours (held in mos_editor.c) are up to date
+;
+_vdp_shadow:		DS	1
+
+; Incremented for every byte (or block) sent to the VDP; a reply only
+; describes the VDP state if this has not changed since the request was sent
+;
+_vdp_txcount:		DS	1
+
 ;
 ; Userspace hooks
 ;
@@ -3,7 +3,7 @@
 ; Author:	Copyright (C) 2005 by ZiLOG, Inc.  All Rights Reserved.
 ; Modified By:	Dean Belfield
 ; Created:	10/07/2022
-; Last Updated:	29/03/2023
+; Last Updated:	16/10/2026
 ;
 ; Modinfo:
 ; 11/07/2022:	Added RST_10 code - TX
@@ -15,6 +15,7 @@
 ; 17/03/2023:	Added RST_18 code
 ; 22/03/2023:	Moved putch to serial.asm, renamed serial_PUTCH
 ; 29/03/2023:	Added support for UART1
+; 16/10/2026:	RST_18 writes the block out in FIFO sized bursts with UART0_serial_WRITE
 
 			INCLUDE	"../src/macros.inc"
 			INCLUDE	"../src/equs.inc"
@@ -37,6 +38,7 @@
 			XREF	_on_crash
 			XREF	mos_api
 			XREF	UART0_serial_PUTCH 
+			XREF	UART0_serial_WRITE
 			XREF	SET_AHL24
 
 NVECTORS 		EQU 48			; Number of interrupt vectors
@@ -136,23 +138,27 @@ _rst_18_handler:	LD	E, A 			; Preserve the delimiter
 ;
 ; Standard loop mode
 ;
-_rst_18_handler_0:	LD 	A, (HL)			; Fetch the character
-			CALL	UART0_serial_PUTCH	; Output
-			INC 	HL 			; Increment the buffer pointer
-			DEC	BC 			; Decrement the loop counter
-			LD	A, B 			; Is it 0?
-			OR 	C 
-			JR	NZ, _rst_18_handler_0	; No, so loop
+			CALL	UART0_serial_WRITE	; Output the block
 			RET.L
 ;
 ; Delimited mode
 ;
-_rst_18_handler_1:	LD 	A, (HL)			; Fetch the character
-			CP 	E 			; Is it the delimiter?
-			RET.L	Z 			; Yes, so return
-			CALL	UART0_serial_PUTCH	; Output
-			INC 	HL 			; Increment the buffer pointer
-			JR 	_rst_18_handler_1	; Loop
+_rst_18_handler_1:	PUSH	HL			; Find the delimiter
+			LD	A, E
+			LD	BC, 0
+			CPIR
+			DEC	HL			; HL: Address of the delimiter
+			POP	DE			; DE: Start of the buffer
+			PUSH	HL
+			OR	A, A
+			SBC	HL, DE			; Length of the string
+			PUSH	HL
+			POP	BC			; BC: Number of bytes to write
+			EX	DE, HL			; HL: Start of the buffer
+			CALL	UART0_serial_WRITE	; Output the string
+			POP	HL			; HL: Address of the delimiter
+			LD	A, (HL)			; A: The delimiter
+			RET.L
 
 ; Crash handler
 __rst_38_handler:	JP	_on_crash